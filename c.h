@@ -17,6 +17,15 @@ typedef struct Type Type;
 typedef struct Node Node;
 typedef struct Member Member;
 
+/*  main.c  */
+extern int opt_level;
+extern bool opt_fssa;
+extern bool opt_fdump_ir;
+extern bool opt_fpeephole_stats;
+extern bool opt_fomit_frame_pointer;
+extern char *opt_fprofile_generate;
+extern char *opt_fprofile_use;
+
 /*  strings.c   */
 char *format(char *fmt, ...);
 
@@ -65,12 +74,17 @@ struct Obj {
     bool is_local;  /* local or global/function */
 
     int offset;     /* local variable   */
+    int reg;        /* register holding the local, 0 if it lives on the stack  */
+    int stack_idx;  /* 1 + the local's index among codegen's stack locals, 0 if none */
+    Node *scope;    /* block or "for" declaring the local, NULL for the whole function */
 
     bool is_function;   /* global variable or function */
     bool is_definition;
     bool is_static;
+    bool is_live;       /* reachable from a non-static symbol   */
 
     char *init_data;    /* global variable  */
+    bool is_readonly;   /* emitted to .rodata   */
 
     /*  function    */
     Obj *params;
@@ -158,6 +172,14 @@ struct Node {
     
     Obj *var;           /* variable   */
     int64_t val;        /* numeric literal   */
+
+    /*  the bytes of 'var' an ND_MEMZERO clears, all of them if
+        zero_len is 0.   */
+    int zero_offset;
+    int zero_len;
+
+    int prof_id;        /* first profile counter, 0 if none */
+    int scope_id;       /* codegen's number for a scope, 0 if none */
 };
 
 Node *new_cast(Node *expr, Type *ty);
@@ -226,6 +248,136 @@ Type *enum_type(void);
 Type *struct_type(void);
 void add_type(Node *node);
 
+/*  fold.c  */
+void fold_constants(Obj *prog);
+
+/*  inline.c    */
+void inline_functions(Obj *prog);
+
+/*  licm.c  */
+void hoist_loop_invariants(Obj *prog);
+
+/*  cse.c  */
+void eliminate_common_subexprs(Obj *prog);
+
+/*  profile.c   */
+void assign_profile_ids(Obj *prog);
+void read_profile(char *path);
+int64_t profile_count(Node *node, int k);
+void gen_counter(Node *node, int k);
+void emit_profile_runtime(void);
+
+/*  ir.c    */
+typedef struct BB BB;
+typedef struct Ins Ins;
+
+typedef enum {
+    IR_IMM,         /* integer constant             */
+    IR_PARAM,       /* incoming argument            */
+    IR_LADDR,       /* address of a local variable  */
+    IR_GADDR,       /* address of a global variable */
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_MOD,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_SHL,
+    IR_SHR,
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_NEG,
+    IR_NOT,         /* bitwise not      */
+    IR_SEXT,        /* sign-extend from 'size' bytes    */
+    IR_LOAD,
+    IR_STORE,
+    IR_MEMCPY,
+    IR_MEMZERO,
+    IR_CALL,
+    IR_PHI,
+    IR_JMP,
+    IR_BR,
+    IR_RET,
+} IRKind;
+
+/*  an instruction, which is also the SSA value it defines.
+    every value is kept sign-extended to 64 bits.   */
+struct Ins {
+    Ins *next;
+    IRKind kind;
+    BB *bb;
+    int id;
+    int size;       /* operation width or memory access size    */
+    int64_t val;    /* IR_IMM value or IR_PARAM index   */
+    Obj *var;       /* IR_LADDR, IR_GADDR, or the local an IR_PHI merges */
+    char *funcname; /* IR_CALL  */
+
+    Ins **ops;
+    int nops;
+    BB **phi_bbs;   /* incoming block of each IR_PHI operand    */
+
+    BB *then;       /* IR_JMP and IR_BR targets */
+    BB *els;
+
+    Ins *fwd;       /* replacement value    */
+    bool dead;
+
+    /*  location assigned by the backend    */
+    int reg;
+    int offset;
+};
+
+struct BB {
+    BB *next;
+    int id;
+    Ins *ins;
+    Ins *last;
+
+    BB **preds;
+    int npreds;
+
+    /*  dominator tree  */
+    int rpo;
+    BB *idom;
+    BB **df;
+    int ndf;
+};
+
+typedef struct {
+    Obj *fn;
+    BB *bbs;        /* basic blocks in layout order, the entry first */
+    int nvals;
+} IRFunc;
+
+BB *new_bb(void);
+int get_succs(BB *bb, BB **succs);
+void compute_preds(IRFunc *f);
+IRFunc *lower_function(Obj *fn);
+void mem2reg(IRFunc *f);
+void dump_ir(IRFunc *f, FILE *out);
+
+/*  irgen.c */
+void gen_ir(IRFunc *f);
+
+/*  peephole.c  */
+char *peephole(char *text);
+void print_peephole_stats(FILE *out);
+
+/*  regalloc.c  */
+#define NUM_LVAR_REGS 5
+
+void alloc_lvar_regs(Obj *fn);
+
 /*  codegen.c  */
+void println(char *fmt, ...);
+void copy_mem(char *dst, char *src, int size, int align);
+void zero_mem(char *base, int offset, int size, int align);
+void gen_mul_imm(int64_t c, int size);
+bool is_div_imm(int64_t d, int size, bool is_mod);
+void gen_div_imm(int64_t d, int size, bool is_mod);
 void codegen(Obj *prog, FILE *out);
 int align_to(int n, int align);
\ No newline at end of file
@@ -6,12 +6,63 @@ static char *argreg8[] = {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"};
 static char *argreg16[] = {"%di", "%si", "%dx", "%cx", "%r8w", "%r9w"};
 static char *argreg32[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
 static char *argreg64[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+
+/*  registers handed out by the register allocator.  1 to NUM_LVAR_REGS are
+    callee-saved and may hold locals; the rest are caller-saved.  index 0
+    is %rdi, which is never allocated and receives temporaries that had to
+    be spilled to the machine stack.                                    */
+static char *reg8[] = {"%dil", "%bl", "%r12b", "%r13b", "%r14b", "%r15b", "%r10b", "%r11b"};
+static char *reg16[] = {"%di", "%bx", "%r12w", "%r13w", "%r14w", "%r15w", "%r10w", "%r11w"};
+static char *reg32[] = {"%edi", "%ebx", "%r12d", "%r13d", "%r14d", "%r15d", "%r10d", "%r11d"};
+static char *reg64[] = {"%rdi", "%rbx", "%r12", "%r13", "%r14", "%r15", "%r10", "%r11"};
+#define NUM_REGS (sizeof(reg64) / sizeof(*reg64))
+
+/*  struct copies of at least this many bytes use 'rep movsb'.    */
+#define REP_MOVSB_MIN 256
+
+/*  zeroing at least this many bytes uses 'rep stosb'.   */
+#define REP_STOSB_MIN 256
+
+/*  switches with fewer cases than this compare them one by one.  */
+#define MIN_JUMP_TABLE 4
+
+/*  memcpy and memset of at most this many bytes are expanded inline,
+    and so is memcmp of at most INLINE_MEMCMP_MAX.   */
+#define INLINE_MEM_MAX 128
+#define INLINE_MEMCMP_MAX 32
+
+/*  loop conditions of up to this many nodes are copied to the entry.  */
+#define MAX_COPIED_COND 32
+
+/*  registers holding expression temporaries, outermost first.  */
+static int tmpregs[NUM_REGS];
+static int num_tmpregs;
+static int used_regs;   /* bitmap of registers written by the current function  */
+static int spilled;     /* number of 8-byte slots pushed on the machine stack   */
+static int max_spilled;
+
+/*  without a frame pointer the frame is addressed off %rsp.  offsets
+    stay relative to where %rbp would be, 8 bytes below the entry %rsp,
+    so locals keep their alignment and stack arguments their offsets. */
+static bool omit_fp;
+static int frame_size;
+
+/*  callee-saved registers the prologue spills right below the locals. */
+static int saved_regs[NUM_REGS];
+static int num_saved;
+
+/*  true if no local's address can outlive a call from the function,
+    which lets 'return f()' release the frame before jumping to 'f'. */
+static bool tail_calls_ok;
+
+static Obj *current_prog;
 static Obj *current_fn;
 
 static void gen_expr(Node *node);
 static void gen_stmt(Node *node);
+static bool gen_lea(Node *node);
 
-static void println(char *fmt, ...) {
+void println(char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
     vfprintf(output_file, fmt, ap);
@@ -24,22 +75,86 @@ static int count(void) {
     return i++;
 }
 
+static bool is_callee_saved(int r) {
+    return 1 <= r && r <= NUM_LVAR_REGS;
+}
+
+/*  push %rax onto the stack of temporaries.  the first num_tmpregs
+    temporaries live in registers, deeper ones go to the machine stack. */
 static void push(void) {
-    println("\tpush\t%%rax");
+    if (depth < num_tmpregs) {
+        int r = tmpregs[depth];
+        println("\tmov\t%%rax, %s", reg64[r]);
+        used_regs |= 1 << r;
+    } else {
+        println("\tpush\t%%rax");
+        spilled++;
+        max_spilled = MAX(max_spilled, spilled);
+    }
     depth++;
 }
+
+/*  pop the innermost temporary and return the register holding it. */
+static int pop_reg(void) {
+    depth--;
+    if (depth < num_tmpregs)
+        return tmpregs[depth];
+    println("\tpop\t%%rdi");
+    spilled--;
+    return 0;
+}
+
 static void pop(char *arg) {
+    if (depth <= num_tmpregs) {
+        println("\tmov\t%s, %s", reg64[tmpregs[--depth]], arg);
+        return;
+    }
     println("\tpop\t%s", arg);
+    spilled--;
     depth--;
 }
+
+/*  caller-saved registers holding live temporaries are saved around
+    a call.  returns the number of registers pushed.   */
+static int save_tmpregs(void) {
+    int n = 0;
+    for (int i = 0; i < depth && i < num_tmpregs; i++) {
+        if (!is_callee_saved(tmpregs[i])) {
+            println("\tpush\t%s", reg64[tmpregs[i]]);
+            n++;
+        }
+    }
+    spilled += n;
+    return n;
+}
+
+static void restore_tmpregs(int n) {
+    for (int i = MIN(depth, num_tmpregs) - 1; i >= 0; i--)
+        if (!is_callee_saved(tmpregs[i]))
+            println("\tpop\t%s", reg64[tmpregs[i]]);
+    spilled -= n;
+}
 int align_to(int n, int align) {
     return (n + align -1) / align * align;
 }
+
+/*  the register and displacement that address a stack slot at 'offset'
+    from the frame base.     */
+static char *fp_reg(void) {
+    return omit_fp ? "%rsp" : "%rbp";
+}
+
+static int fp_offset(int offset) {
+    return omit_fp ? offset + frame_size + spilled * 8 - 8 : offset;
+}
 static void gen_addr(Node *node) {
+    if (gen_lea(node))
+        return;
+
     switch (node->kind) {
     case ND_VAR:
         if (node->var->is_local)    /*  local variable  */
-            println("\tlea\t%d(%%rbp), %%rax", node->var->offset);
+            println("\tlea\t%d(%s), %%rax", fp_offset(node->var->offset), fp_reg());
         else                        /* global variable  */
             println("\tlea\t%s(%%rip), %%rax", node->var->name);
         return;
@@ -73,26 +188,102 @@ static void load(Type *ty) {
     else
         println("\tmov\t(%%rax), %%rax");
 }
+/*  copy 'size' bytes from (src) to (dst).  large blocks use 'rep movsb',
+    which clobbers %rsi, %rdi and %rcx; smaller ones are moved in the
+    widest pieces that fit, through %xmm0 and %r8, and leave 'src' and
+    'dst' intact.  x86 tolerates misaligned moves, so 'align' only
+    selects the aligned SSE form.  */
+void copy_mem(char *dst, char *src, int size, int align) {
+    if (size >= REP_MOVSB_MIN) {
+        println("\tmov\t%s, %%rsi", src);
+        if (strcmp(dst, "%rdi"))
+            println("\tmov\t%s, %%rdi", dst);
+        println("\tmov\t$%d, %%rcx", size);
+        println("\trep movsb");
+        return;
+    }
+
+    char *movx = (align >= 16) ? "movdqa" : "movdqu";
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        println("\t%s\t%d(%s), %%xmm0", movx, i, src);
+        println("\t%s\t%%xmm0, %d(%s)", movx, i, dst);
+    }
+
+    static char *r8[] = {[1] = "%r8b", [2] = "%r8w", [4] = "%r8d", [8] = "%r8"};
+    for (int w = 8; w > 0; w /= 2) {
+        for (; i + w <= size; i += w) {
+            println("\tmov\t%d(%s), %s", i, src, r8[w]);
+            println("\tmov\t%s, %d(%s)", r8[w], i, dst);
+        }
+    }
+}
+
+/*  clear 'size' bytes at offset(base).  small blocks take immediate
+    stores, medium ones 16-byte stores of a cleared %xmm0, and only
+    large ones pay the startup cost of 'rep stosb'.   */
+void zero_mem(char *base, int offset, int size, int align) {
+    if (size >= REP_STOSB_MIN) {
+        /* 'rep stosb' is equivalent to 'memset(%rdi, %al, %rcx)'   */
+        println("\tmov\t$%d, %%rcx", size);
+        println("\tlea\t%d(%s), %%rdi", offset, base);
+        println("\tmov\t$0, %%al");
+        println("\trep stosb");
+        return;
+    }
+
+    int i = 0;
+    if (size >= 16) {
+        char *movx = (align >= 16) ? "movdqa" : "movdqu";
+        println("\tpxor\t%%xmm0, %%xmm0");
+        for (; i + 16 <= size; i += 16)
+            println("\t%s\t%%xmm0, %d(%s)", movx, offset + i, base);
+    }
+
+    static char *suffix[] = {[1] = "b", [2] = "w", [4] = "l", [8] = "q"};
+    for (int w = 8; w > 0; w /= 2)
+        for (; i + w <= size; i += w)
+            println("\tmov%s\t$0, %d(%s)", suffix[w], offset + i, base);
+}
+
 /*  store %rax to an address that the stack top is pointing to.     */
 static void store(Type *ty) {
-    pop("%rdi");
+    char *di = reg64[pop_reg()];
 
-    if (ty->kind == TY_STRUCT || ty->kind == TY_UNION) {
-        for (int i = 0; i < ty->size; i++) {
-            println("\tmov\t%d(%%rax), %%r8b", i);
-            println("\tmov\t%%r8b, %d(%%rdi)", i);
-        }
+    /*  an array is only assigned from its initializer template.  */
+    if (ty->kind == TY_STRUCT || ty->kind == TY_UNION || ty->kind == TY_ARRAY) {
+        copy_mem(di, "%rax", ty->size, ty->align);
         return;
     }
 
     if (ty->size == 1)
-        println("\tmov\t%%al, (%%rdi)");
+        println("\tmov\t%%al, (%s)", di);
     else if (ty->size == 2)
-        println("\tmov\t%%ax, (%%rdi)");
+        println("\tmov\t%%ax, (%s)", di);
     else if (ty->size == 4)
-        println("\tmov\t%%eax, (%%rdi)");
+        println("\tmov\t%%eax, (%s)", di);
+    else
+        println("\tmov\t%%rax, (%s)", di);
+}
+
+/*  a local held in a register is kept sign-extended to 64 bits,
+    which is what load() would have produced.   */
+static void store_reg(Obj *var, char **src) {
+    int sz = var->ty->size;
+    char *dst = reg64[var->reg];
+
+    if (sz == 1)
+        println("\tmovsbq\t%s, %s", src[0], dst);
+    else if (sz == 2)
+        println("\tmovswq\t%s, %s", src[1], dst);
+    else if (sz == 4)
+        println("\tmovslq\t%s, %s", src[2], dst);
     else
-        println("\tmov\t%%rax, (%%rdi)");
+        println("\tmov\t%s, %s", src[3], dst);
+}
+
+static bool is_reg_var(Node *node) {
+    return node->kind == ND_VAR && node->var->reg;
 }
 
 static void cmp_zero(Type *ty) {
@@ -141,6 +332,951 @@ static void cast(Type *from, Type *to) {
         println("\t%s", cast_table[t1][t2]);
 }
 
+/*
+ *  arithmetic by constants
+ */
+
+static int log2_exact(uint64_t c) {
+    if (c == 0 || (c & (c - 1)))
+        return -1;
+    return __builtin_ctzll(c);
+}
+
+/*  multiply %rax by 'c'.  powers of two become shifts and 3, 5 and 9
+    times a power of two a 'lea' and a shift.   */
+void gen_mul_imm(int64_t c, int size) {
+    char *ax = (size == 8) ? "%rax" : "%eax";
+    bool neg = c < 0;
+    uint64_t abs = neg ? -(uint64_t)c : c;
+
+    if (c == 0) {
+        println("\txor\t%%eax, %%eax");
+        return;
+    }
+
+    int k = log2_exact(abs);
+    int scale = 0;
+    static int lea_mul[] = {3, 5, 9};
+    for (int i = 0; i < 3 && k < 0; i++) {
+        if (abs % lea_mul[i] == 0 && log2_exact(abs / lea_mul[i]) >= 0) {
+            scale = lea_mul[i] - 1;
+            k = log2_exact(abs / lea_mul[i]);
+        }
+    }
+
+    if (k < 0) {
+        if (c == (int32_t)c) {
+            println("\timul\t$%ld, %s, %s", c, ax, ax);
+        } else {
+            println("\tmov\t$%ld, %%rcx", c);
+            println("\timul\t%%rcx, %%rax");
+        }
+        return;
+    }
+
+    if (scale)
+        println("\tlea\t(%%rax,%%rax,%d), %s", scale, ax);
+    if (k)
+        println("\tshl\t$%d, %s", k, ax);
+    if (neg)
+        println("\tneg\t%s", ax);
+}
+
+/*  the multiplier and shift that turn signed division by 'd' into a
+    multiplication for 'bits' wide operands (Hacker's Delight 10-1).  */
+static void magic(int64_t d, int bits, int64_t *mul, int *shift) {
+    uint64_t two = (uint64_t)1 << (bits - 1);
+    uint64_t ad = d < 0 ? -(uint64_t)d : d;
+    uint64_t t = two + ((uint64_t)d >> 63);
+    uint64_t anc = t - 1 - t % ad;
+    uint64_t q1 = two / anc, r1 = two - q1 * anc;
+    uint64_t q2 = two / ad, r2 = two - q2 * ad;
+    uint64_t mask = (bits == 64) ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+    int p = bits - 1;
+    uint64_t delta;
+
+    do {
+        p++;
+        q1 = (q1 * 2) & mask;
+        r1 = (r1 * 2) & mask;
+        if (r1 >= anc) {
+            q1 = (q1 + 1) & mask;
+            r1 = (r1 - anc) & mask;
+        }
+        q2 = (q2 * 2) & mask;
+        r2 = (r2 * 2) & mask;
+        if (r2 >= ad) {
+            q2 = (q2 + 1) & mask;
+            r2 = (r2 - ad) & mask;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    uint64_t m = (q2 + 1) & mask;
+    if (d < 0)
+        m = -m & mask;
+    *mul = (bits == 64) ? (int64_t)m : (int32_t)m;
+    *shift = p - bits;
+}
+
+/*  true if gen_div_imm() can divide by 'd'; the rest is left to 'idiv'.
+    the remainder multiplies the quotient back by 'd', so 'd' has to
+    fit an immediate there unless it is a power of two.     */
+bool is_div_imm(int64_t d, int size, bool is_mod) {
+    if (d == 0 || d == INT64_MIN || (size == 4 && d != (int32_t)d))
+        return false;
+    uint64_t ad = d < 0 ? -(uint64_t)d : d;
+    return !is_mod || d == (int32_t)d || log2_exact(ad) > 0;
+}
+
+/*  divide %rax by 'd', or take the remainder, without 'idiv'.  a power
+    of two is a biased shift; anything else a multiply by the magic
+    number and a fixup.     */
+void gen_div_imm(int64_t d, int size, bool is_mod) {
+    char *ax = (size == 8) ? "%rax" : "%eax";
+    char *cx = (size == 8) ? "%rcx" : "%ecx";
+    char *dx = (size == 8) ? "%rdx" : "%edx";
+    int bits = size * 8;
+
+    uint64_t ad = d < 0 ? -(uint64_t)d : d;
+    int k = log2_exact(ad);
+
+    if (ad == 1) {
+        if (is_mod)
+            println("\txor\t%%eax, %%eax");
+        else if (d < 0)
+            println("\tneg\t%s", ax);
+        return;
+    }
+
+    if (k > 0) {
+        /*  round toward zero by adding 2^k-1 to a negative dividend.  */
+        println("\tmov\t%s, %s", ax, dx);
+        println("\tsar\t$%d, %s", bits - 1, dx);
+        println("\tshr\t$%d, %s", bits - k, dx);
+        println("\tadd\t%s, %s", dx, ax);
+        if (is_mod) {
+            if (ad - 1 <= INT32_MAX) {
+                println("\tand\t$%ld, %s", ad - 1, ax);
+            } else {
+                println("\tmov\t$%ld, %%rcx", ad - 1);
+                println("\tand\t%%rcx, %%rax");
+            }
+            println("\tsub\t%s, %s", dx, ax);
+            return;
+        }
+        println("\tsar\t$%d, %s", k, ax);
+        if (d < 0)
+            println("\tneg\t%s", ax);
+        return;
+    }
+
+    int64_t m;
+    int s;
+    magic(d, bits, &m, &s);
+
+    println("\tmov\t%s, %s", ax, cx);
+    if (size == 8) {
+        println("\tmov\t$%ld, %%rdx", m);
+        println("\timul\t%%rdx");
+    } else {
+        /*  the 64-bit product of two 32-bit values holds the high half. */
+        println("\tmovslq\t%%eax, %%rax");
+        println("\timul\t$%ld, %%rax, %%rdx", m);
+        println("\tsar\t$32, %%rdx");
+    }
+    if (d > 0 && m < 0)
+        println("\tadd\t%s, %s", cx, dx);
+    if (d < 0 && m > 0)
+        println("\tsub\t%s, %s", cx, dx);
+    if (s)
+        println("\tsar\t$%d, %s", s, dx);
+    println("\tmov\t%s, %s", dx, ax);
+    println("\tshr\t$%d, %s", bits - 1, ax);
+    println("\tadd\t%s, %s", dx, ax);
+
+    if (is_mod) {
+        println("\timul\t$%ld, %s, %s", d, ax, ax);
+        println("\tsub\t%s, %s", ax, cx);
+        println("\tmov\t%s, %s", cx, ax);
+    }
+}
+
+/*  '*', '/' and '%' with a constant operand at -O.  */
+static bool gen_arith_imm(Node *node) {
+    if (!opt_level)
+        return false;
+    if (node->kind != ND_MUL && node->kind != ND_DIV && node->kind != ND_MOD)
+        return false;
+
+    int size = (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base) ? 8 : 4;
+
+    if (node->kind == ND_MUL) {
+        Node *num = node->rhs->kind == ND_NUM ? node->rhs :
+                    node->lhs->kind == ND_NUM ? node->lhs : NULL;
+        if (!num)
+            return false;
+        gen_expr(num == node->rhs ? node->lhs : node->rhs);
+        gen_mul_imm(num->val, size);
+        return true;
+    }
+
+    bool is_mod = node->kind == ND_MOD;
+    if (node->rhs->kind != ND_NUM || !is_div_imm(node->rhs->val, size, is_mod))
+        return false;
+
+    gen_expr(node->lhs);
+    gen_div_imm(node->rhs->val, size, is_mod);
+    return true;
+}
+
+/*  the immediate for a constant operand of a 'size'-byte operation, or
+    NULL if the constant does not fit in one.  */
+static char *imm_operand(Node *node, int size) {
+    if (node->kind != ND_NUM)
+        return NULL;
+    if (size < 8)
+        return format("$%d", (int32_t)node->val);
+    return node->val == (int32_t)node->val ? format("$%ld", node->val) : NULL;
+}
+
+/*  the condition code of a comparison, with its operands swapped if
+    'swap' is set.  */
+static char *cmp_cc(NodeKind kind, bool swap) {
+    switch (kind) {
+    case ND_EQ: return "e";
+    case ND_NE: return "ne";
+    case ND_LT: return swap ? "g" : "l";
+    case ND_LE: return swap ? "ge" : "le";
+    }
+    unreachable();
+}
+
+/*  the other binary operators with a constant operand at -O.  the
+    constant becomes an immediate instead of a second register, and
+    moves to the right of a commutative operator or a comparison.  */
+static bool gen_binary_imm(Node *node) {
+    if (!opt_level)
+        return false;
+
+    char *insn;
+    bool is_cmp = false;
+    switch (node->kind) {
+    case ND_ADD:    insn = "add"; break;
+    case ND_SUB:    insn = "sub"; break;
+    case ND_BITAND: insn = "and"; break;
+    case ND_BITOR:  insn = "or"; break;
+    case ND_BITXOR: insn = "xor"; break;
+    case ND_SHL:    insn = "shl"; break;
+    case ND_SHR:    insn = "sar"; break;
+    case ND_EQ:
+    case ND_NE:
+    case ND_LT:
+    case ND_LE:
+        insn = "cmp";
+        is_cmp = true;
+        break;
+    default:
+        return false;
+    }
+
+    Node *lhs = node->lhs, *rhs = node->rhs;
+    bool swap = lhs->kind == ND_NUM && rhs->kind != ND_NUM &&
+                node->kind != ND_SUB && node->kind != ND_SHL && node->kind != ND_SHR;
+    if (swap) {
+        lhs = node->rhs;
+        rhs = node->lhs;
+    }
+
+    int size = (lhs->ty->kind == TY_LONG || lhs->ty->base) ? 8 : 4;
+    char *imm = imm_operand(rhs, size);
+    if (!imm)
+        return false;
+    if ((node->kind == ND_SHL || node->kind == ND_SHR) &&
+        (rhs->val < 0 || rhs->val >= size * 8))
+        return false;
+
+    char *ax = (size == 8) ? "%rax" : "%eax";
+    gen_expr(lhs);
+    println("\t%s\t%s, %s", insn, imm, ax);
+    if (is_cmp) {
+        println("\tset%s\t%%al", cmp_cc(node->kind, swap));
+        println("\tmovzb\t%%al, %%rax");
+    }
+    return true;
+}
+
+/*
+ *  addressing modes
+ */
+
+/*  an x86 memory operand, disp(base,index,scale).  the base is the
+    frame slot or symbol of 'var', or else 'base': a pointer value, or
+    the address of an lvalue if 'base_is_lvalue' is set.  */
+typedef struct {
+    Obj *var;
+    Node *base;
+    bool base_is_lvalue;
+    Node *index;
+    int scale;
+    int64_t disp;
+} Addr;
+
+static void addr_of_value(Node *node, Addr *a);
+
+/*  the register of a local whose value 'node' is, looking through
+    widening conversions since such registers are kept sign-extended.  */
+static int reg_of(Node *node) {
+    while (node->kind == ND_CAST && is_integer(node->ty) && node->ty->kind != TY_BOOL &&
+           is_integer(node->lhs->ty) && node->ty->size >= node->lhs->ty->size)
+        node = node->lhs;
+    return is_reg_var(node) ? node->var->reg : 0;
+}
+
+/*  skip conversions between 8-byte integers.    */
+static Node *strip_long_casts(Node *node) {
+    while (node->kind == ND_CAST && is_integer(node->ty) && node->ty->size == 8 &&
+           is_integer(node->lhs->ty) && node->lhs->ty->size == 8)
+        node = node->lhs;
+    return node;
+}
+
+/*  move a constant term of an index into the displacement.  an int sum
+    is widened term by term, as its overflow would be undefined.    */
+static Node *split_index(Node *index, int scale, int64_t *disp) {
+    Node *sum = index;
+    bool widen = false;
+    if (sum->kind == ND_CAST && is_integer(sum->lhs->ty) && sum->lhs->ty->size == 4) {
+        sum = sum->lhs;
+        widen = true;
+    }
+    if ((sum->kind != ND_ADD && sum->kind != ND_SUB) || sum->rhs->kind != ND_NUM ||
+        !is_integer(sum->ty))
+        return index;
+
+    int64_t k = sum->rhs->val * scale;
+    *disp += (sum->kind == ND_ADD) ? k : -k;
+    return widen ? new_cast(sum->lhs, ty_long) : sum->lhs;
+}
+
+/*  'p + i' or 'p - i' as an operand, if the offset folds into one.  */
+static bool addr_of_sum(Node *node, Addr *a) {
+    /*  the offset was converted to the pointer type.  */
+    Node *rhs = node->rhs;
+    if (rhs->kind == ND_CAST && rhs->ty->base)
+        rhs = rhs->lhs;
+    if ((!is_integer(rhs->ty) && rhs->ty->kind != TY_PTR) || rhs->ty->size != 8)
+        return false;
+    rhs = strip_long_casts(rhs);
+    Node *index = NULL;
+    int scale = 1;
+    int64_t disp = 0;
+
+    if (rhs->kind == ND_NUM) {
+        disp = rhs->val;
+    } else {
+        if (node->kind == ND_SUB)
+            return false;
+        index = rhs;
+        if (rhs->kind == ND_MUL && rhs->rhs->kind == ND_NUM) {
+            int64_t s = rhs->rhs->val;
+            if (s == 1 || s == 2 || s == 4 || s == 8) {
+                index = rhs->lhs;
+                scale = s;
+            }
+        }
+        index = split_index(strip_long_casts(index), scale, &disp);
+    }
+    if (node->kind == ND_SUB)
+        disp = -disp;
+
+    Addr b = {};
+    addr_of_value(node->lhs, &b);
+    if (index && b.index)
+        return false;
+    disp += b.disp;
+    if (disp != (int32_t)disp)
+        return false;
+
+    *a = b;
+    a->disp = disp;
+    if (index) {
+        a->index = index;
+        a->scale = scale;
+    }
+    return true;
+}
+
+/*  decompose the address of the object that 'node' designates.  */
+static void addr_of(Node *node, Addr *a) {
+    switch (node->kind) {
+    case ND_VAR:
+        if (node->var->reg)
+            break;
+        a->var = node->var;
+        return;
+    case ND_MEMBER:
+        addr_of(node->lhs, a);
+        a->disp += node->member->offset;
+        return;
+    case ND_DEREF:
+        addr_of_value(node->lhs, a);
+        return;
+    }
+    a->base = node;
+    a->base_is_lvalue = true;
+}
+
+/*  decompose the pointer value 'node'.  */
+static void addr_of_value(Node *node, Addr *a) {
+    /*  an array evaluates to its address.  */
+    if (node->ty->kind == TY_ARRAY &&
+        (node->kind == ND_VAR || node->kind == ND_MEMBER || node->kind == ND_DEREF)) {
+        addr_of(node, a);
+        return;
+    }
+
+    switch (node->kind) {
+    case ND_ADDR:
+        addr_of(node->lhs, a);
+        return;
+    case ND_CAST:
+        if (node->ty->kind == TY_PTR && node->lhs->ty->base) {
+            addr_of_value(node->lhs, a);
+            return;
+        }
+        break;
+    case ND_ADD:
+    case ND_SUB:
+        if (node->lhs->ty->base && addr_of_sum(node, a))
+            return;
+        break;
+    }
+    a->base = node;
+}
+
+/*  true if the base of 'a' has to be computed into a register.  a
+    global needs one only to be combined with an index.  */
+static bool needs_base_reg(Addr *a) {
+    if (a->base)
+        return a->base_is_lvalue || !reg_of(a->base);
+    return !a->var->is_local && a->index;
+}
+
+/*  evaluate the index and base of 'a'.  with 'hold' set they are pushed,
+    for more code runs before the operand is used; otherwise the last of
+    them stays in %rax.  */
+static void gen_addr_regs(Addr *a, bool hold) {
+    bool base = needs_base_reg(a);
+
+    if (a->index && !reg_of(a->index)) {
+        gen_expr(a->index);
+        if (hold || base)
+            push();
+    }
+    if (!base)
+        return;
+
+    if (a->base_is_lvalue)
+        gen_addr(a->base);
+    else if (a->base)
+        gen_expr(a->base);
+    else
+        println("\tlea\t%s(%%rip), %%rax", a->var->name);
+    if (hold)
+        push();
+}
+
+/*  a popped temporary, in 'spare' if it comes off the machine stack,
+    so that two of them do not collide in %rdi.  */
+static char *pop_to(char *spare) {
+    if (depth <= num_tmpregs)
+        return reg64[pop_reg()];
+    pop(spare);
+    return spare;
+}
+
+/*  pop what gen_addr_regs() left and return the memory operand.  */
+static char *mem_operand(Addr *a, bool hold) {
+    bool base = needs_base_reg(a);
+    char *breg = NULL, *ireg = NULL;
+    int64_t disp = a->disp;
+
+    if (base)
+        breg = hold ? pop_to("%rsi") : "%rax";
+    if (a->index) {
+        int r = reg_of(a->index);
+        ireg = r ? reg64[r] : (hold || base) ? pop_to("%rdx") : "%rax";
+    }
+
+    if (!breg) {
+        if (a->base) {
+            breg = reg64[reg_of(a->base)];
+        } else if (a->var->is_local) {
+            breg = fp_reg();
+            disp += fp_offset(a->var->offset);
+        } else {
+            return format("%s%+ld(%%rip)", a->var->name, disp);
+        }
+    }
+
+    char *d = disp ? format("%ld", disp) : "";
+    if (ireg)
+        return format("%s(%s,%s,%d)", d, breg, ireg, a->scale);
+    return format("%s(%s)", d, breg);
+}
+
+static bool is_scalar(Type *ty) {
+    return is_integer(ty) || ty->kind == TY_PTR;
+}
+
+/*  the address of a member or element at -O, in a single 'lea'.  */
+static bool gen_lea(Node *node) {
+    if (!opt_level || (node->kind != ND_MEMBER && node->kind != ND_DEREF))
+        return false;
+
+    Addr a = {};
+    addr_of(node, &a);
+    if (a.base && !a.index && !a.disp) {
+        if (a.base_is_lvalue)
+            gen_addr(a.base);
+        else
+            gen_expr(a.base);
+        return true;
+    }
+
+    gen_addr_regs(&a, false);
+    println("\tlea\t%s, %%rax", mem_operand(&a, false));
+    return true;
+}
+
+/*  a scalar variable, member or element loaded straight from its
+    operand at -O.  */
+static bool gen_load(Node *node) {
+    if (!opt_level || !is_scalar(node->ty))
+        return false;
+
+    Addr a = {};
+    addr_of(node, &a);
+    gen_addr_regs(&a, false);
+    char *mem = mem_operand(&a, false);
+
+    if (node->ty->size == 1)
+        println("\tmovsbl\t%s, %%eax", mem);
+    else if (node->ty->size == 2)
+        println("\tmovswl\t%s, %%eax", mem);
+    else if (node->ty->size == 4)
+        println("\tmovsxd\t%s, %%rax", mem);
+    else
+        println("\tmov\t%s, %%rax", mem);
+    return true;
+}
+
+/*  an assignment to a scalar in memory at -O, stored straight to its
+    operand, from an immediate if the value is a constant.  */
+static bool gen_store(Node *node, bool need_value) {
+    Node *lhs = node->lhs;
+    if (!opt_level || !is_scalar(lhs->ty) || is_reg_var(lhs))
+        return false;
+
+    int size = lhs->ty->size;
+    int sz = log2_exact(size);
+    Node *rhs = node->rhs;
+    bool is_imm = rhs->kind == ND_NUM && (size < 8 || rhs->val == (int32_t)rhs->val);
+
+    Addr a = {};
+    addr_of(lhs, &a);
+    gen_addr_regs(&a, !is_imm);
+    if (!is_imm)
+        gen_expr(rhs);
+    char *mem = mem_operand(&a, !is_imm);
+
+    if (is_imm) {
+        int64_t imm = rhs->val;
+        if (size < 8)
+            imm = (size == 4) ? (int32_t)imm : (size == 2) ? (int16_t)imm : (int8_t)imm;
+        println("\tmov%c\t$%ld, %s", "bwlq"[sz], imm, mem);
+        if (need_value)
+            println("\tmov\t$%ld, %%rax", imm);
+    } else {
+        println("\tmov\t%s, %s", (char *[]){"%al", "%ax", "%eax", "%rax"}[sz], mem);
+    }
+    return true;
+}
+
+/*
+ *  read-modify-write
+ */
+
+/*  true if two side-effect free expressions compute the same value.   */
+static bool same_expr(Node *a, Node *b) {
+    if (a->kind != b->kind || a->ty->size != b->ty->size)
+        return false;
+
+    switch (a->kind) {
+    case ND_VAR:
+        return a->var == b->var;
+    case ND_NUM:
+        return a->val == b->val;
+    case ND_MEMBER:
+        return a->member == b->member && same_expr(a->lhs, b->lhs);
+    case ND_DEREF:
+    case ND_ADDR:
+    case ND_CAST:
+    case ND_NEG:
+        return same_expr(a->lhs, b->lhs);
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+        return same_expr(a->lhs, b->lhs) && same_expr(a->rhs, b->rhs);
+    }
+    return false;
+}
+
+/*  skip conversions that keep the low 'size' bytes of a value.   */
+static Node *strip_casts(Node *node, int size) {
+    while (node->kind == ND_CAST && node->ty->kind != TY_BOOL &&
+           node->ty->size >= size && node->lhs->ty->size >= size)
+        node = node->lhs;
+    return node;
+}
+
+/*  'A = A op B' at -O, where op only needs the low bytes of A, becomes
+    a single instruction that updates A in place.  the value of the
+    assignment is loaded back only if 'need_value' is set.  */
+static bool gen_rmw(Node *node, bool need_value) {
+    if (!opt_level || node->kind != ND_ASSIGN)
+        return false;
+
+    Node *lhs = node->lhs;
+    Type *ty = lhs->ty;
+    if (!(is_integer(ty) && ty->kind != TY_BOOL) && ty->kind != TY_PTR)
+        return false;
+
+    int size = ty->size;
+    Node *op = strip_casts(node->rhs, size);
+    char *insn;
+    switch (op->kind) {
+    case ND_ADD:    insn = "add"; break;
+    case ND_SUB:    insn = "sub"; break;
+    case ND_BITAND: insn = "and"; break;
+    case ND_BITOR:  insn = "or"; break;
+    case ND_BITXOR: insn = "xor"; break;
+    case ND_SHL:    insn = "shl"; break;
+    case ND_SHR:    insn = "sar"; break;
+    default:
+        return false;
+    }
+    if (!same_expr(strip_casts(op->lhs, size), lhs))
+        return false;
+
+    /*  the operand is an immediate, or %rax once it is evaluated.  */
+    Node *rhs = op->rhs;
+    bool is_imm = rhs->kind == ND_NUM && (size < 8 || rhs->val == (int32_t)rhs->val);
+    if (op->kind == ND_SHL || op->kind == ND_SHR)
+        if (!is_imm || rhs->val < 0 || rhs->val >= size * 8)
+            return false;
+
+    int sz = log2_exact(size);
+    char *sfx = &"bwlq"[sz];
+    char *ax = (char *[]){"%al", "%ax", "%eax", "%rax"}[sz];
+    int64_t imm = rhs->val;
+    if (size < 8)
+        imm = (size == 4) ? (int32_t)imm : (size == 2) ? (int16_t)imm : (int8_t)imm;
+    char *src = is_imm ? format("$%ld", imm) : ax;
+
+    if (is_reg_var(lhs)) {
+        int r = lhs->var->reg;
+        if (!is_imm)
+            gen_expr(rhs);
+        println("\t%s\t%s, %s", insn, src, (char *[]){reg8[r], reg16[r], reg32[r], reg64[r]}[sz]);
+        /*  keep the register sign-extended.  */
+        if (size < 8)
+            store_reg(lhs->var, (char *[]){reg8[r], reg16[r], reg32[r], reg64[r]});
+        if (need_value)
+            println("\tmov\t%s, %%rax", reg64[r]);
+        return true;
+    }
+
+    if (lhs->kind == ND_VAR) {
+        if (!is_imm)
+            gen_expr(rhs);
+        if (lhs->var->is_local)
+            println("\t%s%c\t%s, %d(%s)", insn, *sfx, src,
+                    fp_offset(lhs->var->offset), fp_reg());
+        else
+            println("\t%s%c\t%s, %s(%%rip)", insn, *sfx, src, lhs->var->name);
+        if (need_value)
+            gen_expr(lhs);
+        return true;
+    }
+
+    if (is_imm) {
+        gen_addr(lhs);
+        println("\t%s%c\t%s, (%%rax)", insn, *sfx, src);
+    } else {
+        gen_expr(rhs);
+        push();
+        gen_addr(lhs);
+        int r = pop_reg();
+        println("\t%s\t%s, (%%rax)", insn, (char *[]){reg8[r], reg16[r], reg32[r], reg64[r]}[sz]);
+    }
+    if (need_value)
+        load(ty);
+    return true;
+}
+
+/*  evaluate 'node' only for its side effects.  */
+static void gen_void(Node *node) {
+    if (!opt_level) {
+        gen_expr(node);
+        return;
+    }
+
+    switch (node->kind) {
+    case ND_ASSIGN:
+        println("\t.loc 1 %d", node->tok->line_no);
+        if (gen_rmw(node, false) || gen_store(node, false))
+            return;
+        break;
+    case ND_CAST:
+        gen_void(node->lhs);
+        return;
+    case ND_ADD:
+    case ND_SUB:
+        /*  what is left of 'x++' once its value is dropped.  */
+        if (node->rhs->kind == ND_NUM) {
+            gen_void(node->lhs);
+            return;
+        }
+        break;
+    case ND_COMMA:
+        gen_void(node->lhs);
+        gen_void(node->rhs);
+        return;
+    }
+    gen_expr(node);
+}
+
+/*
+ *  conditions
+ */
+
+static char *invert_cc(char *cc) {
+    static char *pairs[][2] = {{"e", "ne"}, {"l", "ge"}, {"le", "g"}};
+    for (int i = 0; i < sizeof(pairs) / sizeof(*pairs); i++) {
+        if (!strcmp(cc, pairs[i][0]))
+            return pairs[i][1];
+        if (!strcmp(cc, pairs[i][1]))
+            return pairs[i][0];
+    }
+    unreachable();
+}
+
+/*  jump to 'label' if the truth of 'node' equals 'when', and fall
+    through otherwise.  comparisons branch on the flags they set and
+    '&&', '||' and '!' only rearrange the jumps, so no 0 or 1 is ever
+    built just to be tested again.   */
+static void gen_cond(Node *node, bool when, char *label) {
+    println("\t.loc 1 %d", node->tok->line_no);
+
+    switch (node->kind) {
+    case ND_NUM:
+        if ((node->val != 0) == when)
+            println("\tjmp\t%s", label);
+        return;
+    case ND_NOT:
+        gen_cond(node->lhs, !when, label);
+        return;
+    case ND_LOGAND:
+    case ND_LOGOR: {
+        /*  'a && b' is false as soon as 'a' is, 'a || b' true.  */
+        bool shortcut = node->kind == ND_LOGOR;
+        if (when == shortcut) {
+            gen_cond(node->lhs, when, label);
+            gen_counter(node, 0);
+            gen_cond(node->rhs, when, label);
+            return;
+        }
+        char *skip = format(".L.skip.%d", count());
+        gen_cond(node->lhs, shortcut, skip);
+        gen_counter(node, 0);
+        gen_cond(node->rhs, when, label);
+        println("%s:", skip);
+        return;
+    }
+    case ND_EQ:
+    case ND_NE:
+    case ND_LT:
+    case ND_LE: {
+        /*  at -O a constant is compared as an immediate.  */
+        Node *lhs = node->lhs, *rhs = node->rhs;
+        bool swap = opt_level && lhs->kind == ND_NUM && rhs->kind != ND_NUM;
+        if (swap) {
+            lhs = node->rhs;
+            rhs = node->lhs;
+        }
+
+        int size = (lhs->ty->kind == TY_LONG || lhs->ty->base) ? 8 : 4;
+        char *imm = opt_level ? imm_operand(rhs, size) : NULL;
+        if (imm) {
+            gen_expr(lhs);
+            println("\tcmp\t%s, %s", imm, (size == 8) ? "%rax" : "%eax");
+        } else {
+            gen_expr(rhs);
+            push();
+            gen_expr(lhs);
+            int r = pop_reg();
+            println("\tcmp\t%s, %s", (size == 8) ? reg64[r] : reg32[r],
+                    (size == 8) ? "%rax" : "%eax");
+        }
+
+        char *cc = cmp_cc(node->kind, swap);
+        println("\tj%s\t%s", when ? cc : invert_cc(cc), label);
+        return;
+    }
+    }
+
+    gen_expr(node);
+    cmp_zero(node->ty);
+    println("\t%s\t%s", when ? "jne" : "je", label);
+}
+
+/*
+ *  builtins
+ */
+
+/*  the value of a constant argument, or -1.  */
+static int64_t const_arg(Node *arg) {
+    while (arg->kind == ND_CAST && is_integer(arg->ty))
+        arg = arg->lhs;
+    if (arg->kind != ND_NUM || arg->val < 0)
+        return -1;
+    return arg->val;
+}
+
+static Node *nth_arg(Node *node, int n) {
+    Node *arg = node->args;
+    for (int i = 0; arg && i < n; i++)
+        arg = arg->next;
+    return arg;
+}
+
+/*  true for a call of memcpy, memset or memcmp with a small constant
+    size that gen_builtin expands inline.  a program defining one of
+    them itself keeps its calls.    */
+static bool is_builtin(Node *node) {
+    if (!opt_level || !nth_arg(node, 2) || nth_arg(node, 3))
+        return false;
+
+    int64_t max;
+    if (!strcmp(node->funcname, "memcpy") || !strcmp(node->funcname, "memset"))
+        max = INLINE_MEM_MAX;
+    else if (!strcmp(node->funcname, "memcmp"))
+        max = INLINE_MEMCMP_MAX;
+    else
+        return false;
+
+    int64_t size = const_arg(nth_arg(node, 2));
+    if (size < 0 || size > max)
+        return false;
+
+    for (Obj *fn = current_prog; fn; fn = fn->next)
+        if (fn->is_function && fn->is_definition && !strcmp(fn->name, node->funcname))
+            return false;
+    return true;
+}
+
+/*  store the byte pattern in %r8 to 'size' bytes at (base).   */
+static void fill_mem(char *base, int size) {
+    int i = 0;
+    if (size >= 16) {
+        println("\tmovq\t%%r8, %%xmm0");
+        println("\tpunpcklqdq\t%%xmm0, %%xmm0");
+        for (; i + 16 <= size; i += 16)
+            println("\tmovdqu\t%%xmm0, %d(%s)", i, base);
+    }
+
+    static char *r8[] = {[1] = "%r8b", [2] = "%r8w", [4] = "%r8d", [8] = "%r8"};
+    for (int w = 8; w > 0; w /= 2)
+        for (; i + w <= size; i += w)
+            println("\tmov\t%s, %d(%s)", r8[w], i, base);
+}
+
+/*  compare 'size' bytes at (a) and (b) in the widest pieces that fit.
+    at the first piece that differs, both are byte-swapped so that an
+    unsigned comparison orders them like their first differing byte.  */
+static void gen_memcmp(char *a, char *b, int size) {
+    int c = count();
+    static char *load[] = {[1] = "movzbl", [2] = "movzwl", [4] = "mov", [8] = "mov"};
+    static char *r8[] = {[1] = "%r8d", [2] = "%r8d", [4] = "%r8d", [8] = "%r8"};
+    static char *r9[] = {[1] = "%r9d", [2] = "%r9d", [4] = "%r9d", [8] = "%r9"};
+
+    int i = 0;
+    for (int w = 8; w > 0; w /= 2) {
+        for (; i + w <= size; i += w) {
+            println("\t%s\t%d(%s), %s", load[w], i, a, r8[w]);
+            println("\t%s\t%d(%s), %s", load[w], i, b, r9[w]);
+            println("\tcmp\t%%r9, %%r8");
+            println("\tjne\t.L.diff.%d", c);
+        }
+    }
+    println("\txor\t%%eax, %%eax");
+    println("\tjmp\t.L.same.%d", c);
+    println(".L.diff.%d:", c);
+    println("\tbswap\t%%r8");
+    println("\tbswap\t%%r9");
+    println("\tcmp\t%%r9, %%r8");
+    println("\tsbb\t%%rax, %%rax");
+    println("\tor\t$1, %%rax");
+    println(".L.same.%d:", c);
+}
+
+/*  expand a call that is_builtin accepts.  the pointer arguments are
+    evaluated in order, the size never needs to be.  */
+static bool gen_builtin(Node *node) {
+    if (!is_builtin(node))
+        return false;
+    gen_counter(node, 0);
+
+    int size = const_arg(nth_arg(node, 2));
+    gen_expr(node->args);
+    push();
+
+    if (!strcmp(node->funcname, "memset")) {
+        Node *val = node->args->next;
+        int64_t byte = const_arg(val);
+        if (byte >= 0) {
+            byte &= 0xff;
+            if (byte)
+                println("\tmov\t$%ld, %%r8", byte * 0x0101010101010101);
+        } else {
+            gen_expr(val);
+            println("\tmovzbl\t%%al, %%eax");
+            println("\tmov\t$%ld, %%r8", 0x0101010101010101);
+            println("\timul\t%%rax, %%r8");
+        }
+
+        int r = pop_reg();
+        if (byte == 0)
+            zero_mem(reg64[r], 0, size, 1);
+        else
+            fill_mem(reg64[r], size);
+        println("\tmov\t%s, %%rax", reg64[r]);
+        return true;
+    }
+
+    gen_expr(node->args->next);
+    int r = pop_reg();
+    if (!strcmp(node->funcname, "memcpy")) {
+        copy_mem(reg64[r], "%rax", size, 1);
+        println("\tmov\t%s, %%rax", reg64[r]);
+    } else {
+        gen_memcmp(reg64[r], "%rax", size);
+    }
+    return true;
+}
+
 /*  generate code for a given node. */
 static void gen_expr(Node *node) {
     println("\t.loc 1 %d", node->tok->line_no);
@@ -156,11 +1292,24 @@ static void gen_expr(Node *node) {
         println("\tneg\t%%rax");
         return;
     case ND_VAR:
+        if (node->var->reg) {
+            println("\tmov\t%s, %%rax", reg64[node->var->reg]);
+            return;
+        }
+        if (gen_load(node))
+            return;
+        gen_addr(node);
+        load(node->ty);
+        return;
     case ND_MEMBER:
+        if (gen_load(node))
+            return;
         gen_addr(node);
         load(node->ty);
         return;
     case ND_DEREF:
+        if (gen_load(node))
+            return;
         gen_expr(node->lhs);
         load(node->ty);
         return;
@@ -168,17 +1317,31 @@ static void gen_expr(Node *node) {
         gen_addr(node->lhs);
         return;
     case ND_ASSIGN:
+        if (gen_rmw(node, true))
+            return;
+        if (is_reg_var(node->lhs)) {
+            gen_expr(node->rhs);
+            store_reg(node->lhs->var, (char *[]){"%al", "%ax", "%eax", "%rax"});
+            return;
+        }
+        if (gen_store(node, true))
+            return;
         gen_addr(node->lhs);
         push();
         gen_expr(node->rhs);
         store(node->ty);
         return;
     case ND_STMT_EXPR:
-        for (Node *n = node->body; n; n = n->next)
-            gen_stmt(n);
+        for (Node *n = node->body; n; n = n->next) {
+            /*  the last expression statement gives the value.  */
+            if (!n->next && n->kind == ND_EXPR_STMT)
+                gen_expr(n->lhs);
+            else
+                gen_stmt(n);
+        }
         return;
     case ND_COMMA:
-        gen_expr(node->lhs);
+        gen_void(node->lhs);
         gen_expr(node->rhs);
         return;
     case ND_CAST:
@@ -186,20 +1349,38 @@ static void gen_expr(Node *node) {
         cast(node->lhs->ty, node->ty);
         return;
     case ND_MEMZERO:
-        /* 'rep stosb' is equivalent to 'memset(%rdi, %al, %rcx)'   */
-        println("\tmov\t$%d, %%rcx", node->var->ty->size);
-        println("\tlea\t%d(%%rbp), %%rdi", node->var->offset);
-        println("\tmov\t$0, %%al");
-        println("\trep stosb");
+        if (node->var->reg) {
+            println("\txor\t%s, %s", reg32[node->var->reg], reg32[node->var->reg]);
+            return;
+        }
+        if (node->zero_len) {
+            int align = (node->zero_offset % 16) ? 1 : node->var->ty->align;
+            zero_mem(fp_reg(), fp_offset(node->var->offset) + node->zero_offset, node->zero_len,
+                     align);
+            return;
+        }
+        zero_mem(fp_reg(), fp_offset(node->var->offset), node->var->ty->size, node->var->ty->align);
         return;
     case ND_COND: {
         int c = count();
-        gen_expr(node->cond);
-        println("\tcmp\t$0, %%rax");
-        println("\tje\t.L.else.%d", c);
+        if (profile_count(node, 1) > profile_count(node, 0)) {
+            gen_cond(node->cond, true, format(".L.then.%d", c));
+            gen_counter(node, 1);
+            gen_expr(node->els);
+            println("\tjmp\t.L.end.%d", c);
+            println(".L.then.%d:", c);
+            gen_counter(node, 0);
+            gen_expr(node->then);
+            println(".L.end.%d:", c);
+            return;
+        }
+
+        gen_cond(node->cond, false, format(".L.else.%d", c));
+        gen_counter(node, 0);
         gen_expr(node->then);
         println("\tjmp\t.L.end.%d", c);
         println(".L.else.%d:", c);
+        gen_counter(node, 1);
         gen_expr(node->els);
         println(".L.end.%d:", c);
         return ;
@@ -216,12 +1397,7 @@ static void gen_expr(Node *node) {
         return;
     case ND_LOGAND: {
         int c = count();
-        gen_expr(node->lhs);
-        println("\tcmp\t$0, %%rax");
-        println("\tje\t.L.false.%d", c);
-        gen_expr(node->rhs);
-        println("\tcmp\t$0, %%rax");
-        println("\tje\t.L.false.%d", c);
+        gen_cond(node, false, format(".L.false.%d", c));
         println("\tmov\t$1, %%rax");
         println("\tjmp\t.L.end.%d", c);
         println(".L.false.%d:", c);
@@ -229,14 +1405,9 @@ static void gen_expr(Node *node) {
         println(".L.end.%d:", c);
         return;
     }
-    case ND_LOGOR: {
-        int c = count();
-        gen_expr(node->lhs);
-        println("\tcmp\t$0, %%rax");
-        println("\tjne\t.L.true.%d", c);
-        gen_expr(node->rhs);
-        println("\tcmp\t$0, %%rax");
-        println("\tjne\t.L.true.%d", c);
+    case ND_LOGOR: {
+        int c = count();
+        gen_cond(node, true, format(".L.true.%d", c));
         println("\tmov\t$0, %%rax");
         println("\tjmp\t.L.end.%d", c);
         println(".L.true.%d:", c);
@@ -245,6 +1416,9 @@ static void gen_expr(Node *node) {
         return;
     }
     case ND_FUNCALL: {
+        if (gen_builtin(node))
+            return;
+        gen_counter(node, 0);
         int nargs = 0;
         for (Node *arg = node->args; arg; arg = arg->next) {
             gen_expr(arg);
@@ -253,26 +1427,39 @@ static void gen_expr(Node *node) {
         }
         for (int i = nargs - 1; i >= 0; i--)
             pop(argreg64[i]);
-    
+
+        /*  keep %rsp 16-byte aligned at the call as the ABI requires.  */
+        int saved = save_tmpregs();
+        bool pad = spilled % 2;
+        if (pad)
+            println("\tsub\t$8, %%rsp");
+
         println("\tmov\t$0, %%rax");
         println("\tcall\t%s", node->funcname);
+
+        if (pad)
+            println("\tadd\t$8, %%rsp");
+        restore_tmpregs(saved);
         return;
     }
     }
 
+    if (gen_arith_imm(node) || gen_binary_imm(node))
+        return;
+
     gen_expr(node->rhs);
     push();
     gen_expr(node->lhs);
-    pop("%rdi");
+    int r = pop_reg();
 
     char *ax, *di;
 
     if (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base) {
         ax = "%rax";
-        di = "%rdi";
+        di = reg64[r];
     } else {
         ax = "%eax";
-        di = "%edi";
+        di = reg32[r];
     }
 
     switch (node->kind) {
@@ -294,13 +1481,13 @@ static void gen_expr(Node *node) {
             println("\tmov\t%%rdx, %%rax");
         return;
     case ND_BITAND:
-        println("\tand\t%%rdi, %%rax");
+        println("\tand\t%s, %%rax", reg64[r]);
         return;
     case ND_BITOR:
-        println("\tor\t%%rdi, %%rax");
+        println("\tor\t%s, %%rax", reg64[r]);
         return;
     case ND_BITXOR:
-        println("\txor\t%%rdi, %%rax");
+        println("\txor\t%s, %%rax", reg64[r]);
         return;
     case ND_EQ:     
     case ND_NE:
@@ -320,11 +1507,11 @@ static void gen_expr(Node *node) {
         println("\tmovzb\t%%al, %%rax");
         return; 
     case ND_SHL:
-        println("\tmov\t%%rdi, %%rcx");
+        println("\tmov\t%s, %%rcx", reg64[r]);
         println("\tshl\t%%cl, %s", ax);
         return;
     case ND_SHR:
-        println("\tmov\t%%rdi, %%rcx");
+        println("\tmov\t%s, %%rcx", reg64[r]);
         if (node->ty->size == 8)
             println("\tsar\t%%cl, %s", ax);
         else    
@@ -334,18 +1521,496 @@ static void gen_expr(Node *node) {
     error_tok(node->tok, "invalid expression");
 }
 
+static int cmp_case(const void *a, const void *b) {
+    int64_t x = (*(Node **)a)->val;
+    int64_t y = (*(Node **)b)->val;
+    return (x > y) - (x < y);
+}
+
+/*  jump from the switch value in %rax to one of cases[lo..hi), which are
+    sorted by value.  a run of values at least a third dense indexes a
+    .rodata table of label offsets; a sparse run is split around its
+    middle case, so dispatch takes O(log n) compares at worst.     */
+static void gen_case_dispatch(Node **cases, int lo, int hi, char *dflt, bool is_long) {
+    char *ax = is_long ? "%rax" : "%eax";
+    int n = hi - lo;
+
+    if (n < MIN_JUMP_TABLE) {
+        for (int i = lo; i < hi; i++) {
+            println("\tcmp\t$%ld, %s", cases[i]->val, ax);
+            println("\tje\t%s", cases[i]->label);
+        }
+        println("\tjmp\t%s", dflt);
+        return;
+    }
+
+    int c = count();
+    int64_t min = cases[lo]->val;
+    int64_t range = cases[hi - 1]->val - min + 1;
+
+    if (range <= 3 * n) {
+        /*  values below 'min' wrap around and fail the unsigned check.  */
+        println("\tsub\t$%ld, %s", min, ax);
+        println("\tcmp\t$%ld, %s", range - 1, ax);
+        println("\tja\t%s", dflt);
+        println("\tlea\t.L.jtab.%d(%%rip), %%rdi", c);
+        println("\tmovslq\t(%%rdi,%%rax,4), %%rax");
+        println("\tadd\t%%rdi, %%rax");
+        println("\tjmp\t*%%rax");
+
+        println("\t.section\t.rodata");
+        println("\t.align\t4");
+        println(".L.jtab.%d:", c);
+        for (int i = lo; i < hi; i++) {
+            /*  a duplicated value keeps its first entry.  */
+            if (i > lo && cases[i]->val == cases[i - 1]->val)
+                continue;
+            int64_t prev = (i > lo) ? cases[i - 1]->val : min - 1;
+            for (int64_t v = prev + 1; v < cases[i]->val; v++)
+                println("\t.long\t%s-.L.jtab.%d", dflt, c);
+            println("\t.long\t%s-.L.jtab.%d", cases[i]->label, c);
+        }
+        println("\t.text");
+        return;
+    }
+
+    int mid = lo + n / 2;
+    println("\tcmp\t$%ld, %s", cases[mid]->val, ax);
+    println("\tje\t%s", cases[mid]->label);
+    println("\tjg\t.L.case.%d", c);
+    gen_case_dispatch(cases, lo, mid, dflt, is_long);
+    println(".L.case.%d:", c);
+    gen_case_dispatch(cases, mid + 1, hi, dflt, is_long);
+}
+
+/*  the case of a switch that the profile saw take more than half of
+    its executions, or NULL.   */
+static Node *hot_case(Node *node) {
+    Node *hot = NULL;
+    int64_t total = node->default_case ? MAX(profile_count(node->default_case, 0), 0) : 0;
+    for (Node *n = node->case_next; n; n = n->case_next) {
+        int64_t cnt = profile_count(n, 0);
+        if (cnt <= 0)
+            continue;
+        total += cnt;
+        if (!hot || cnt > profile_count(hot, 0))
+            hot = n;
+    }
+    return (hot && profile_count(hot, 0) * 2 > total) ? hot : NULL;
+}
+
+/*  restore the callee-saved registers and release the frame.  */
+static void gen_leave(void) {
+    for (int j = 0; j < num_saved; j++)
+        println("\tmov\t%d(%s), %s",
+                fp_offset(-current_fn->stack_size - (j + 1) * 8), fp_reg(), reg64[saved_regs[j]]);
+    if (omit_fp) {
+        if (frame_size)
+            println("\tadd\t$%d, %%rsp", frame_size);
+    } else {
+        println("\tmov\t%%rbp, %%rsp");
+        println("\tpop\t%%rbp");
+    }
+}
+
+/*  at -O, 'return f(...)' loads the arguments, releases the frame and
+    jumps to 'f', which returns straight to our caller.  a call of the
+    function itself jumps back to where the parameters are stored.  */
+static bool gen_tail_call(Node *node) {
+    if (!opt_level || !tail_calls_ok || depth)
+        return false;
+
+    /*  the result must reach the caller unconverted.   */
+    if (node->kind == ND_CAST && node->ty->kind == node->lhs->ty->kind &&
+        node->ty->size == node->lhs->ty->size)
+        node = node->lhs;
+    if (node->kind != ND_FUNCALL || node->ty->kind == TY_STRUCT || node->ty->kind == TY_UNION ||
+        is_builtin(node))
+        return false;
+    gen_counter(node, 0);
+
+    int nargs = 0;
+    for (Node *arg = node->args; arg; arg = arg->next) {
+        gen_expr(arg);
+        push();
+        nargs++;
+    }
+    for (int i = nargs - 1; i >= 0; i--)
+        pop(argreg64[i]);
+
+    if (!strcmp(node->funcname, current_fn->name)) {
+        println("\tjmp\t.L.entry.%s", current_fn->name);
+        return true;
+    }
+
+    gen_leave();
+    println("\tmov\t$0, %%rax");
+    println("\tjmp\t%s", node->funcname);
+    return true;
+}
+
+/*
+ *  vectorization
+ */
+
+/*  at -O a counted loop
+
+        for (...; i < n; i++) a[i] = b[i] op c[i];
+
+    over integer arrays first runs 16 bytes at a time through the SSE2
+    registers, and the scalar loop then finishes the elements that are
+    left.  every array must be a named array object, so two different
+    ones never overlap, and is only touched at index i, so no iteration
+    depends on another.  the operators are +, -, &, |, ^ and, for shorts,
+    *, which wrap the same way in each lane as in the low bytes of a
+    scalar register, and those are all that the store keeps.  %xmm0 to
+    %xmm7 evaluate the expressions and %xmm8 up hold the constants.    */
+
+#define VEC_MAX_REGS 8
+#define VEC_MAX_CONSTS 8
+#define VEC_MAX_BASES 4
+
+static Obj *vec_index;      /* the induction variable   */
+static int vec_size;        /* bytes per element    */
+static int64_t vec_consts[VEC_MAX_CONSTS];
+static int vec_nconsts;
+
+/*  global arrays are addressed through a register holding their base.
+    the loop may run inside an expression, so it keeps to registers
+    outside the pool of expression temporaries: %rdx builds the
+    constants before it holds a base, and %r9 holds the bound.  */
+static Obj *vec_bases[VEC_MAX_BASES];
+static int vec_nbases;
+static char *vec_base_regs[] = {"%rcx", "%rsi", "%r8", "%rdx"};
+
+/*  true if 'node' reads the induction variable, possibly widened.  */
+static bool is_vec_index(Node *node) {
+    node = strip_casts(node, vec_index->ty->size);
+    return node->kind == ND_VAR && node->var == vec_index;
+}
+
+/*  the array of an element 'a[i]', or NULL.  */
+static Obj *vec_elem(Node *node) {
+    if (node->kind != ND_DEREF || !is_integer(node->ty) || node->ty->kind == TY_BOOL ||
+        node->ty->size != vec_size)
+        return NULL;
+
+    Node *add = node->lhs;
+    if (add->kind != ND_ADD)
+        return NULL;
+    Node *base = strip_casts(add->lhs, 8);
+    if (base->kind != ND_VAR || base->ty->kind != TY_ARRAY)
+        return NULL;
+
+    /*  x*1 is folded away for char arrays.  */
+    Node *idx = strip_casts(add->rhs, 8);
+    if (idx->kind == ND_MUL && idx->rhs->kind == ND_NUM && idx->rhs->val == vec_size)
+        idx = idx->lhs;
+    else if (vec_size != 1)
+        return NULL;
+    return is_vec_index(idx) ? base->var : NULL;
+}
+
+static char *vec_insn(Node *node) {
+    if (!is_integer(node->ty))
+        return NULL;
+
+    char sfx = "bw d   q"[vec_size - 1];
+    switch (node->kind) {
+    case ND_ADD:    return format("padd%c", sfx);
+    case ND_SUB:    return format("psub%c", sfx);
+    case ND_BITAND: return "pand";
+    case ND_BITOR:  return "por";
+    case ND_BITXOR: return "pxor";
+    case ND_MUL:    return (vec_size == 2) ? "pmullw" : NULL;
+    }
+    return NULL;
+}
+
+/*  the constant with the low 'vec_size' bytes of 'val'.  */
+static int vec_const(int64_t val) {
+    if (vec_size < 8)
+        val &= (1L << (vec_size * 8)) - 1;
+    for (int k = 0; k < vec_nconsts; k++)
+        if (vec_consts[k] == val)
+            return k;
+    if (vec_nconsts == VEC_MAX_CONSTS)
+        return -1;
+    vec_consts[vec_nconsts] = val;
+    return vec_nconsts++;
+}
+
+static bool add_vec_base(Obj *var) {
+    if (var->is_local)
+        return true;
+    for (int k = 0; k < vec_nbases; k++)
+        if (vec_bases[k] == var)
+            return true;
+    if (vec_nbases == VEC_MAX_BASES)
+        return false;
+    vec_bases[vec_nbases++] = var;
+    return true;
+}
+
+/*  the number of xmm registers evaluating 'node' takes, or -1 if it
+    cannot be computed lane by lane.     */
+static int vec_regs(Node *node) {
+    node = strip_casts(node, vec_size);
+    if (node->kind == ND_NUM)
+        return (is_integer(node->ty) && vec_const(node->val) >= 0) ? 1 : -1;
+
+    Obj *var = vec_elem(node);
+    if (var)
+        return add_vec_base(var) ? 1 : -1;
+
+    if (!vec_insn(node))
+        return -1;
+    int l = vec_regs(node->lhs);
+    int r = vec_regs(node->rhs);
+    if (l < 0 || r < 0)
+        return -1;
+    return MAX(l, r + 1);
+}
+
+static bool is_vec_stmt(Node *node) {
+    if (node->kind != ND_EXPR_STMT || node->lhs->kind != ND_ASSIGN)
+        return false;
+
+    Node *assign = node->lhs;
+    if (!vec_size)
+        vec_size = assign->lhs->ty->size;
+    if (!vec_elem(assign->lhs) || !add_vec_base(vec_elem(assign->lhs)))
+        return false;
+    int n = vec_regs(assign->rhs);
+    return 0 < n && n <= VEC_MAX_REGS;
+}
+
+/*  true if 'node' is 'i++', 'i += 1' or 'i = i + 1'.  */
+static bool is_vec_step(Node *node) {
+    /*  what is left of 'i++' is the assignment less one.  */
+    while (node->kind == ND_CAST || (node->kind == ND_ADD && node->rhs->kind == ND_NUM))
+        node = node->lhs;
+    if (node->kind != ND_ASSIGN || node->lhs->kind != ND_VAR || node->lhs->var != vec_index)
+        return false;
+
+    Node *rhs = strip_casts(node->rhs, vec_index->ty->size);
+    return rhs->kind == ND_ADD && is_vec_index(rhs->lhs) &&
+           rhs->rhs->kind == ND_NUM && rhs->rhs->val == 1;
+}
+
+static bool is_vec_loop(Node *node) {
+    Node *cond = node->cond;
+    if (!cond || cond->kind != ND_LT || !node->inc || !node->then)
+        return false;
+
+    /*  'i < n' with an integer i of at least 4 bytes that is compared
+        without truncation, and a bound the body cannot change.  */
+    Node *iv = strip_casts(cond->lhs, 4);
+    if (iv->kind != ND_VAR || !iv->var->is_local || !is_integer(iv->ty) ||
+        iv->ty->size < 4 || cond->lhs->ty->size < iv->ty->size)
+        return false;
+    vec_index = iv->var;
+
+    Node *n = strip_casts(cond->rhs, 4);
+    if (n->kind != ND_NUM && (n->kind != ND_VAR || !is_integer(n->ty) || n->var == vec_index))
+        return false;
+    if (!is_vec_step(node->inc))
+        return false;
+
+    vec_size = 0;
+    vec_nconsts = 0;
+    vec_nbases = 0;
+    if (node->then->kind == ND_EXPR_STMT)
+        return is_vec_stmt(node->then);
+    if (node->then->kind != ND_BLOCK || !node->then->body)
+        return false;
+    for (Node *n = node->then->body; n; n = n->next)
+        if (!is_vec_stmt(n))
+            return false;
+    return true;
+}
+
+/*  the memory operand of 'a[i]' with i in %rax.  */
+static char *vec_addr(Node *node) {
+    Obj *var = vec_elem(node);
+    if (var->is_local)
+        return format("%d(%s,%%rax,%d)", fp_offset(var->offset), fp_reg(), vec_size);
+
+    for (int k = 0;; k++)
+        if (vec_bases[k] == var)
+            return format("(%s,%%rax,%d)", vec_base_regs[k], vec_size);
+}
+
+/*  evaluate 'node' into %xmm<r>.  */
+static void gen_vec_expr(Node *node, int r) {
+    node = strip_casts(node, vec_size);
+    if (node->kind == ND_NUM) {
+        println("\tmovdqa\t%%xmm%d, %%xmm%d", 8 + vec_const(node->val), r);
+        return;
+    }
+    if (node->kind == ND_DEREF) {
+        println("\tmovdqu\t%s, %%xmm%d", vec_addr(node), r);
+        return;
+    }
+
+    gen_vec_expr(node->lhs, r);
+    Node *rhs = strip_casts(node->rhs, vec_size);
+    if (rhs->kind == ND_NUM) {
+        println("\t%s\t%%xmm%d, %%xmm%d", vec_insn(node), 8 + vec_const(rhs->val), r);
+        return;
+    }
+    gen_vec_expr(rhs, r + 1);
+    println("\t%s\t%%xmm%d, %%xmm%d", vec_insn(node), r + 1, r);
+}
+
+/*  fill every lane of %xmm<8+k> with constant k.  */
+static void gen_vec_const(int k) {
+    char *x = format("%%xmm%d", 8 + k);
+    if (vec_size == 8) {
+        println("\tmov\t$%ld, %%rdx", vec_consts[k]);
+        println("\tmovq\t%%rdx, %s", x);
+        println("\tpunpcklqdq\t%s, %s", x, x);
+        return;
+    }
+
+    uint32_t lane = vec_consts[k];
+    if (vec_size == 1)
+        lane *= 0x01010101;
+    else if (vec_size == 2)
+        lane *= 0x00010001;
+    println("\tmov\t$%u, %%edx", lane);
+    println("\tmovd\t%%edx, %s", x);
+    println("\tpshufd\t$0, %s, %s", x, x);
+}
+
+/*  the value of a comparison operand, sign-extended to 64 bits.  loads
+    of variables already are.   */
+static void gen_vec_bound(Node *node) {
+    gen_expr(node);
+    if (node->ty->size == 4 && node->kind != ND_VAR && node->kind != ND_NUM)
+        println("\tmovsxd\t%%eax, %%rax");
+}
+
+/*  emit the vector loop in front of the scalar loop of 'node', which
+    starts at 'scalar'.  */
+static void gen_vector_loop(Node *node, char *scalar) {
+    if (!opt_level || !is_vec_loop(node))
+        return;
+
+    int c = count();
+    int width = 16 / vec_size;
+
+    /*  %r9 is where the vector loop stops, the last multiple of the
+        width before n.  n - i cannot overflow once i < n is known.  */
+    gen_vec_bound(node->cond->rhs);
+    println("\tmov\t%%rax, %%rdx");
+    gen_vec_bound(node->cond->lhs);
+    println("\tcmp\t%%rdx, %%rax");
+    println("\tjge\t%s", scalar);
+    println("\tmov\t%%rdx, %%r9");
+    println("\tsub\t%%rax, %%r9");
+    println("\tand\t$%d, %%r9", -width);
+    println("\tje\t%s", scalar);
+    println("\tadd\t%%rax, %%r9");
+
+    for (int k = 0; k < vec_nconsts; k++)
+        gen_vec_const(k);
+    for (int k = 0; k < vec_nbases; k++)
+        println("\tlea\t%s(%%rip), %s", vec_bases[k]->name, vec_base_regs[k]);
+
+    println(".L.vec.%d:", c);
+    Node *body = (node->then->kind == ND_BLOCK) ? node->then->body : node->then;
+    for (Node *n = body; n; n = n->next) {
+        gen_vec_expr(n->lhs->rhs, 0);
+        println("\tmovdqu\t%%xmm0, %s", vec_addr(n->lhs->lhs));
+    }
+    println("\tadd\t$%d, %%rax", width);
+    println("\tcmp\t%%rax, %%r9");
+    println("\tjne\t.L.vec.%d", c);
+
+    /*  the scalar loop carries on from where the vector loop stopped.  */
+    if (vec_index->reg)
+        store_reg(vec_index, (char *[]){"%al", "%ax", "%eax", "%rax"});
+    else
+        println("\tmov\t%s, %d(%s)", vec_index->ty->size == 4 ? "%eax" : "%rax",
+                fp_offset(vec_index->offset), fp_reg());
+}
+
+/*
+ *  loops
+ */
+
+/*  true if the condition of a loop is small enough to be emitted twice
+    and defines no labels that a second copy would duplicate.    */
+static bool can_copy_cond(Node *node, int *budget) {
+    if (!node)
+        return true;
+    if (node->kind == ND_STMT_EXPR || --*budget < 0)
+        return false;
+    return can_copy_cond(node->lhs, budget) && can_copy_cond(node->rhs, budget) &&
+           can_copy_cond(node->cond, budget) && can_copy_cond(node->then, budget) &&
+           can_copy_cond(node->els, budget);
+}
+
+/*  the loop test sits at the bottom, so an iteration ends in a single
+    branch taken only while the loop goes on.  a copy of the test guards
+    the first entry, or if the test cannot be copied the loop is entered
+    with a jump to it.  the body is aligned for the branch back.    */
+static void gen_rotated_loop(Node *node, int c) {
+    int budget = MAX_COPIED_COND;
+    bool copy = can_copy_cond(node->cond, &budget);
+
+    if (node->cond) {
+        if (copy)
+            gen_cond(node->cond, false, node->brk_label);
+        else
+            println("\tjmp\t.L.test.%d", c);
+    }
+
+    println("\t.p2align\t4,,10");
+    println(".L.body.%d:", c);
+    gen_counter(node, 0);
+    gen_stmt(node->then);
+    println("%s:", node->cont_label);
+    if (node->inc)
+        gen_void(node->inc);
+
+    if (node->cond) {
+        if (!copy)
+            println(".L.test.%d:", c);
+        gen_cond(node->cond, true, format(".L.body.%d", c));
+    } else {
+        println("\tjmp\t.L.body.%d", c);
+    }
+    println("%s:", node->brk_label);
+}
+
 static void gen_stmt(Node *node) { 
     println("\t.loc 1 %d", node->tok->line_no);
 
     switch (node->kind) {
     case ND_IF: {
         int c = count();
-        gen_expr(node->cond);
-        println("\tcmp\t$0, %%rax");
-        println("\tje\t.L.else.%d", c);
+        /*  the arm the profile saw run more often falls through.  */
+        if (profile_count(node, 1) > profile_count(node, 0)) {
+            gen_cond(node->cond, true, format(".L.then.%d", c));
+            gen_counter(node, 1);
+            if (node->els)
+                gen_stmt(node->els);
+            println("\tjmp\t.L.end.%d", c);
+            println(".L.then.%d:", c);
+            gen_counter(node, 0);
+            gen_stmt(node->then);
+            println(".L.end.%d:", c);
+            return;
+        }
+
+        gen_cond(node->cond, false, format(".L.else.%d", c));
+        gen_counter(node, 0);
         gen_stmt(node->then);
         println("\tjmp\t.L.end.%d", c);
         println(".L.else.%d:", c);
+        gen_counter(node, 1);
         if (node->els)
             gen_stmt(node->els);
         println(".L.end.%d:", c);
@@ -355,39 +2020,56 @@ static void gen_stmt(Node *node) {
         int c = count();
         if (node->init)
             gen_stmt(node->init);
+        gen_vector_loop(node, format(".L.begin.%d", c));
         println(".L.begin.%d:", c);
-        if (node->cond) {
-            gen_expr(node->cond);
-            println("\tcmp\t$0, %%rax");
-            println("\tje\t%s", node->brk_label);
+        if (opt_level) {
+            gen_rotated_loop(node, c);
+            return;
         }
+        if (node->cond)
+            gen_cond(node->cond, false, node->brk_label);
+        gen_counter(node, 0);
         gen_stmt(node->then);
         println("%s:", node->cont_label);
         if (node->inc)
-            gen_expr(node->inc);
+            gen_void(node->inc);
         println("\tjmp\t.L.begin.%d", c);
         println("%s:", node->brk_label);
         return;
     }
 
-    case ND_SWITCH:
+    case ND_SWITCH: {
         gen_expr(node->cond);
 
-        for (Node *n = node->case_next; n; n = n->case_next) {
-            char *reg = (node->cond->ty->size == 8) ? "%rax" : "%eax";
-            println("\tcmp\t$%ld, %s", n->val, reg);
-            println("\tje\t%s", n->label);
+        int ncases = 0;
+        for (Node *n = node->case_next; n; n = n->case_next)
+            ncases++;
+
+        Node **cases = calloc(ncases, sizeof(Node *));
+        ncases = 0;
+        for (Node *n = node->case_next; n; n = n->case_next)
+            cases[ncases++] = n;
+        qsort(cases, ncases, sizeof(Node *), cmp_case);
+
+        /*  the dominant case is tested before the dispatch.  */
+        bool is_long = node->cond->ty->size == 8;
+        Node *hot = hot_case(node);
+        if (hot) {
+            println("\tcmp\t$%ld, %s", hot->val, is_long ? "%rax" : "%eax");
+            println("\tje\t%s", hot->label);
         }
 
-        if (node->default_case)
-            println("\tjmp\t%s", node->default_case->label);
-        
-        println("\tjmp\t%s", node->brk_label);
+        char *dflt = node->default_case ? node->default_case->label : node->brk_label;
+        gen_case_dispatch(cases, 0, ncases, dflt, is_long);
+        free(cases);
+
         gen_stmt(node->then);
         println("%s:", node->brk_label);
         return;
+    }
     case ND_CASE:
         println("%s:", node->label);
+        gen_counter(node, 0);
         gen_stmt(node->lhs);
         return;
 
@@ -403,23 +2085,264 @@ static void gen_stmt(Node *node) {
         gen_stmt(node->lhs);
         return;
     case ND_RETURN:
+        if (gen_tail_call(node->lhs))
+            return;
         gen_expr(node->lhs);
+        /*  the epilogue cannot reset %rsp from %rbp.   */
+        if (omit_fp && spilled)
+            println("\tadd\t$%d, %%rsp", spilled * 8);
         println("\tjmp\t.L.return.%s", current_fn->name);
         return;
     case ND_EXPR_STMT:
-        gen_expr(node->lhs);
+        gen_void(node->lhs);
         return;
     }
     error_tok(node->tok, "invalid statement");
 }
 /* assign offsets to local variables. */
+/*
+ *  stack slots
+ */
+
+/*  the nodes of a function body are numbered in preorder, and a scope
+    covers the numbers of its subtree.  the scopes themselves are kept
+    in preorder too, with the whole function first, so the scopes
+    inside one follow it directly.    */
+typedef struct Slot Slot;
+
+typedef struct {
+    int parent;
+    int start;
+    int end;
+    Slot *slots;    /* the locals placed in this scope  */
+} ScopeRange;
+
+static ScopeRange *scope_ranges;
+static int num_scopes;
+static int scope_pos;
+
+static void number_scopes(Node *node, int parent) {
+    if (!node)
+        return;
+
+    int start = scope_pos++;
+    int k = parent;
+    if (node->kind == ND_BLOCK || node->kind == ND_FOR || node->kind == ND_STMT_EXPR) {
+        k = num_scopes++;
+        scope_ranges = realloc(scope_ranges, num_scopes * sizeof(ScopeRange));
+        scope_ranges[k] = (ScopeRange){.parent = parent, .start = start};
+        node->scope_id = k;
+    }
+
+    number_scopes(node->lhs, k);
+    number_scopes(node->rhs, k);
+    number_scopes(node->cond, k);
+    number_scopes(node->then, k);
+    number_scopes(node->els, k);
+    number_scopes(node->init, k);
+    number_scopes(node->inc, k);
+    for (Node *n = node->body; n; n = n->next)
+        number_scopes(n, k);
+    for (Node *n = node->args; n; n = n->next)
+        number_scopes(n, k);
+
+    if (k != parent)
+        scope_ranges[k].end = scope_pos;
+}
+
+/*  the scope of a local, the whole function if it has none.  */
+static int var_scope(Obj *var) {
+    return var->scope ? var->scope->scope_id : 0;
+}
+
+/*  a placed local occupies the bytes from 'top - size' up to 'top'
+    below the frame base.   */
+struct Slot {
+    Slot *next;
+    int top;
+    int size;
+};
+
+/*  a stack local and its references, weighted by loop nesting.  */
+typedef struct {
+    Obj *var;
+    int uses;
+    int idx;
+} StackVar;
+
+static StackVar *stack_vars;
+static int num_stack_vars;
+static bool from_sp;    /* the frame will be addressed off %rsp */
+
+/*  a reference inside a loop counts eight times as much as one outside
+    of it, up to four levels deep.  */
+static void count_uses(Node *node, int weight) {
+    if (!node)
+        return;
+
+    if (node->kind == ND_VAR) {
+        int k = node->var->stack_idx - 1;
+        if (k >= 0 && k < num_stack_vars && stack_vars[k].var == node->var)
+            stack_vars[k].uses += weight;
+    }
+
+    int inner = (node->kind == ND_FOR) ? MIN(weight * 8, 4096) : weight;
+    count_uses(node->lhs, weight);
+    count_uses(node->rhs, weight);
+    count_uses(node->cond, inner);
+    count_uses(node->then, inner);
+    count_uses(node->els, weight);
+    count_uses(node->init, weight);
+    count_uses(node->inc, inner);
+    for (Node *n = node->body; n; n = n->next)
+        count_uses(n, weight);
+    for (Node *n = node->args; n; n = n->next)
+        count_uses(n, weight);
+}
+
+static bool is_aggregate(Type *ty) {
+    return ty->kind == TY_ARRAY || ty->kind == TY_STRUCT || ty->kind == TY_UNION;
+}
+
+/*  scalars come first, the most used and the most aligned leading, and
+    aggregates follow from the smallest to the largest.   */
+static int cmp_frame_order(StackVar *a, StackVar *b) {
+    Type *x = a->var->ty;
+    Type *y = b->var->ty;
+    if (is_aggregate(x) != is_aggregate(y))
+        return is_aggregate(x) ? 1 : -1;
+    if (!is_aggregate(x) && a->uses != b->uses)
+        return b->uses - a->uses;
+    if (is_aggregate(x) && x->size != y->size)
+        return x->size - y->size;
+    if (x->align != y->align)
+        return y->align - x->align;
+    return a->idx - b->idx;
+}
+
+/*  locals placed first end up nearest the frame base.  off %rbp that
+    is the order above; off %rsp the base is the far end, so the order
+    is reversed and the hottest scalars are placed last.   */
+static int cmp_stack_var(const void *a, const void *b) {
+    int c = cmp_frame_order((StackVar *)a, (StackVar *)b);
+    return from_sp ? -c : c;
+}
+
+static bool has_funcall(Node *node);
+
+static int cmp_slot(const void *a, const void *b) {
+    Slot *x = *(Slot **)a;
+    Slot *y = *(Slot **)b;
+    return (x->top - x->size) - (y->top - y->size);
+}
+
+/*  the locals whose scopes overlap scope k, those of the scopes that
+    enclose it and of the scopes inside it.  returns their number.  */
+static int overlapping_slots(int k, Slot ***buf, int *cap) {
+    int n = 0;
+    int end = scope_ranges[k].end;
+
+    for (int j = k;; j = scope_ranges[j].parent) {
+        for (Slot *s = scope_ranges[j].slots; s; s = s->next) {
+            if (n == *cap)
+                *buf = realloc(*buf, (*cap = *cap * 2 + 16) * sizeof(Slot *));
+            (*buf)[n++] = s;
+        }
+        if (j == 0)
+            break;
+    }
+    for (int j = k + 1; j < num_scopes && scope_ranges[j].start < end; j++) {
+        for (Slot *s = scope_ranges[j].slots; s; s = s->next) {
+            if (n == *cap)
+                *buf = realloc(*buf, (*cap = *cap * 2 + 16) * sizeof(Slot *));
+            (*buf)[n++] = s;
+        }
+    }
+    return n;
+}
+
+/*  locals whose scopes are disjoint, such as those of sibling blocks,
+    are never alive together and may share their bytes.  each local
+    goes to the lowest position that fits its alignment and overlaps
+    no local of an enclosing or enclosed scope: the start of the first
+    gap between those locals that is large enough.  the locals are
+    placed in an order that keeps the frequently used scalars within a
+    one-byte displacement of the frame base and lets small locals fill
+    the padding between larger ones.   */
+static void share_stack_slots(Obj *fn) {
+    scope_ranges = calloc(1, sizeof(ScopeRange));
+    num_scopes = 1;
+    scope_pos = 0;
+    number_scopes(fn->body, 0);
+    scope_ranges[0].end = scope_pos;
+
+    num_stack_vars = 0;
+    for (Obj *var = fn->locals; var; var = var->next)
+        num_stack_vars++;
+    stack_vars = calloc(num_stack_vars, sizeof(StackVar));
+    num_stack_vars = 0;
+    for (Obj *var = fn->locals; var; var = var->next) {
+        if (var->reg)
+            continue;
+        stack_vars[num_stack_vars].var = var;
+        stack_vars[num_stack_vars].idx = num_stack_vars;
+        var->stack_idx = ++num_stack_vars;
+    }
+
+    /*  the same test emit_function makes.  */
+    from_sp = opt_fomit_frame_pointer || !has_funcall(fn->body);
+    count_uses(fn->body, 1);
+    qsort(stack_vars, num_stack_vars, sizeof(StackVar), cmp_stack_var);
+
+    Slot **buf = NULL;
+    int cap = 0;
+    int stack_size = 0;
+
+    for (int i = 0; i < num_stack_vars; i++) {
+        Obj *var = stack_vars[i].var;
+        int k = var_scope(var);
+        int size = var->ty->size;
+
+        int n = overlapping_slots(k, &buf, &cap);
+        qsort(buf, n, sizeof(Slot *), cmp_slot);
+
+        /*  'low' is where the current gap starts.  */
+        int low = 0;
+        int best = align_to(size, var->ty->align);
+        for (int j = 0; j < n && buf[j]->top - buf[j]->size < best; j++) {
+            low = MAX(low, buf[j]->top);
+            best = align_to(low + size, var->ty->align);
+        }
+
+        Slot *slot = calloc(1, sizeof(Slot));
+        slot->top = best;
+        slot->size = size;
+        slot->next = scope_ranges[k].slots;
+        scope_ranges[k].slots = slot;
+
+        var->offset = -best;
+        stack_size = MAX(stack_size, best);
+    }
+    fn->stack_size = align_to(stack_size, 16);
+    free(buf);
+    free(stack_vars);
+    free(scope_ranges);
+}
+
 static void assign_lvar_offsets(Obj *prog) {
     for (Obj *fn = prog; fn; fn = fn->next) {
         if (!fn->is_function)
             continue;
 
+        if (opt_level && fn->is_definition) {
+            share_stack_slots(fn);
+            continue;
+        }
+
         int offset = 0;
         for (Obj *var = fn->locals; var; var = var->next) {
+            if (var->reg)
+                continue;
             offset += var->ty->size;
             offset = align_to(offset, var->ty->align);
             var->offset = -offset;
@@ -427,13 +2350,70 @@ static void assign_lvar_offsets(Obj *prog) {
         fn->stack_size = align_to(offset, 16);
     }
 }
+
+/*  at -O only the definitions that a non-static symbol reaches through
+    calls and references are emitted.    */
+static Obj *find_definition(Obj *prog, char *name) {
+    for (Obj *var = prog; var; var = var->next)
+        if (!strcmp(var->name, name) && (var->is_definition || !var->is_function))
+            return var;
+    return NULL;
+}
+
+static void mark_live(Obj *prog, Obj *var);
+
+static void mark_refs(Obj *prog, Node *node) {
+    if (!node)
+        return;
+
+    if (node->kind == ND_VAR && !node->var->is_local)
+        mark_live(prog, node->var->is_function ? find_definition(prog, node->var->name) : node->var);
+    if (node->kind == ND_FUNCALL)
+        mark_live(prog, find_definition(prog, node->funcname));
+
+    mark_refs(prog, node->lhs);
+    mark_refs(prog, node->rhs);
+    mark_refs(prog, node->cond);
+    mark_refs(prog, node->then);
+    mark_refs(prog, node->els);
+    mark_refs(prog, node->init);
+    mark_refs(prog, node->inc);
+    for (Node *n = node->body; n; n = n->next)
+        mark_refs(prog, n);
+    for (Node *n = node->args; n; n = n->next)
+        mark_refs(prog, n);
+}
+
+static void mark_live(Obj *prog, Obj *var) {
+    if (!var || var->is_live)
+        return;
+    var->is_live = true;
+    if (var->is_function)
+        mark_refs(prog, var->body);
+}
+
+static void find_live(Obj *prog) {
+    for (Obj *var = prog; var; var = var->next)
+        if (!var->is_static || !opt_level)
+            mark_live(prog, var);
+}
+
 static void emit_data(Obj *prog) {
     for (Obj *var = prog; var; var = var->next) {
-        if (var->is_function)
+        if (var->is_function || !var->is_live)
             continue;
         
-        println("\t.data");
-        println("\t.globl\t%s", var->name);
+        if (var->is_readonly) {
+            /*  aligned like the local it initializes.  */
+            println("\t.section\t.rodata");
+            println("\t.align\t%d", var->ty->align);
+        } else {
+            println("\t.data");
+        }
+        if (var->is_static)
+            println("\t.local\t%s", var->name);
+        else
+            println("\t.globl\t%s", var->name);
         println("%s:", var->name);
         
         if (var->init_data) {
@@ -448,26 +2428,193 @@ static void emit_data(Obj *prog) {
 static void store_gp(int r, int offset, int sz) {
     switch (sz) {
     case 1:
-        println("\tmov\t%s, %d(%%rbp)", argreg8[r], offset);
+        println("\tmov\t%s, %d(%s)", argreg8[r], fp_offset(offset), fp_reg());
         return;
     case 2:
-        println("\tmov\t%s, %d(%%rbp)", argreg16[r], offset);
+        println("\tmov\t%s, %d(%s)", argreg16[r], fp_offset(offset), fp_reg());
         return;
     case 4:
-        println("\tmov\t%s, %d(%%rbp)", argreg32[r], offset);
+        println("\tmov\t%s, %d(%s)", argreg32[r], fp_offset(offset), fp_reg());
         return;
     case 8:
-        println("\tmov\t%s, %d(%%rbp)", argreg64[r], offset);
+        println("\tmov\t%s, %d(%s)", argreg64[r], fp_offset(offset), fp_reg());
         return;
     }
     unreachable();
 }
 
-static void emit_text(Obj *prog) {
-    assign_lvar_offsets(prog);
+/*  set up the pool of temporary registers for a function.  the
+    caller-saved ones come first so that short-lived temporaries do not
+    cost a save in the prologue.     */
+static void init_tmpregs(Obj *fn) {
+    used_regs = 0;
+    num_tmpregs = 0;
+    spilled = 0;
+    max_spilled = 0;
+
+    for (Obj *var = fn->locals; var; var = var->next)
+        if (var->reg)
+            used_regs |= 1 << var->reg;
+
+    if (!opt_level)
+        return;
+
+    for (int r = NUM_LVAR_REGS + 1; r < NUM_REGS; r++)
+        tmpregs[num_tmpregs++] = r;
+    for (int r = 1; r <= NUM_LVAR_REGS; r++)
+        if (!(used_regs & (1 << r)))
+            tmpregs[num_tmpregs++] = r;
+}
+
+static bool has_funcall(Node *node) {
+    if (!node)
+        return false;
+    if (node->kind == ND_FUNCALL)
+        return true;
+
+    if (has_funcall(node->lhs) || has_funcall(node->rhs) || has_funcall(node->cond) ||
+        has_funcall(node->then) || has_funcall(node->els) || has_funcall(node->init) ||
+        has_funcall(node->inc))
+        return true;
+    for (Node *n = node->body; n; n = n->next)
+        if (has_funcall(n))
+            return true;
+    return false;
+}
+
+/*  true if the address of a local may be computed in 'node'.  local
+    arrays count wherever they appear, since they decay to a pointer.  */
+static bool takes_local_addr(Node *node) {
+    if (!node)
+        return false;
+    if (node->kind == ND_VAR && node->var->is_local && node->var->ty->kind == TY_ARRAY)
+        return true;
+    if (node->kind == ND_ADDR) {
+        Node *n = node->lhs;
+        while (n->kind == ND_MEMBER || n->kind == ND_COMMA)
+            n = (n->kind == ND_MEMBER) ? n->lhs : n->rhs;
+        if (n->kind == ND_VAR && n->var->is_local)
+            return true;
+    }
+
+    if (takes_local_addr(node->lhs) || takes_local_addr(node->rhs) ||
+        takes_local_addr(node->cond) || takes_local_addr(node->then) ||
+        takes_local_addr(node->els) || takes_local_addr(node->init) ||
+        takes_local_addr(node->inc))
+        return true;
+    for (Node *n = node->body; n; n = n->next)
+        if (takes_local_addr(n))
+            return true;
+    for (Node *n = node->args; n; n = n->next)
+        if (takes_local_addr(n))
+            return true;
+    return false;
+}
+
+/*  emit the body of a function into a string.    */
+static char *gen_body(Obj *fn) {
+    init_tmpregs(fn);
+
+    FILE *out = output_file;
+    char *buf;
+    size_t buflen;
+    output_file = open_memstream(&buf, &buflen);
+
+    gen_counter(fn->body, 0);
+
+    /*  a self-recursive tail call re-enters here.   */
+    if (opt_level)
+        println(".L.entry.%s:", fn->name);
+
+    /*  save passed by register arguments to the stack  */
+    int i = 0;
+    for (Obj *var = fn->params; var; var = var->next) {
+        if (var->reg)
+            store_reg(var, (char *[]){argreg8[i], argreg16[i], argreg32[i], argreg64[i]});
+        else
+            store_gp(i, var->offset, var->ty->size);
+        i++;
+    }
+
+    /*  emit code   */
+    gen_stmt(fn->body);
+    assert(depth == 0);
+    fclose(output_file);
+    output_file = out;
+    return buf;
+}
+
+static void emit_function(Obj *fn) {
+    if (opt_fssa) {
+        IRFunc *f = lower_function(fn);
+        if (opt_level)
+            mem2reg(f);
+        if (opt_fdump_ir)
+            dump_ir(f, stderr);
+        gen_ir(f);
+        return;
+    }
+
+    current_fn = fn;
+    omit_fp = false;
+    frame_size = 0;
+    num_saved = 0;
+    tail_calls_ok = !takes_local_addr(fn->body);
+
+    /*  the body is emitted into a buffer first, so that the prologue
+        knows which callee-saved registers it has to preserve.   */
+    char *body = gen_body(fn);
+    for (int r = 1; r <= NUM_LVAR_REGS; r++)
+        if (used_regs & (1 << r))
+            saved_regs[num_saved++] = r;
+    int frame = fn->stack_size + num_saved * 8;
+
+    /*  a leaf function at -O, or any function with -fomit-frame-pointer,
+        addresses its frame off %rsp.  a leaf whose frame fits the
+        128-byte red zone below %rsp, and which never pushes onto it,
+        does not move %rsp at all.  otherwise %rsp keeps the 16-byte
+        alignment that calls need.  */
+    bool leaf = !has_funcall(fn->body);
+    if (opt_level && (leaf || opt_fomit_frame_pointer)) {
+        omit_fp = true;
+        if (leaf && !max_spilled && frame + 8 <= 128)
+            frame_size = 0;
+        else
+            frame_size = align_to(frame, 16) + 8;
+    }
+
+    /*  the frame layout and the saved registers are known now, which
+        tail calls need to leave the frame early.   */
+    if (opt_level) {
+        free(body);
+        body = gen_body(fn);
+    }
+
+    /*  prologue    */
+    if (omit_fp) {
+        if (frame_size)
+            println("\tsub\t$%d, %%rsp", frame_size);
+    } else {
+        println("\tpush\t%%rbp");
+        println("\tmov\t%%rsp, %%rbp");
+        println("\tsub\t$%d, %%rsp", align_to(frame, 16));
+    }
+    for (int j = 0; j < num_saved; j++)
+        println("\tmov\t%s, %d(%s)",
+                reg64[saved_regs[j]], fp_offset(-fn->stack_size - (j + 1) * 8), fp_reg());
+
+    fputs(body, output_file);
+    free(body);
 
+    /* epilogue */
+    println(".L.return.%s:", fn->name);
+    gen_leave();
+    println("\tret");
+}
+
+static void emit_text(Obj *prog) {
     for (Obj *fn = prog; fn; fn = fn->next) {
-        if (!fn->is_function || !fn->is_definition)
+        if (!fn->is_function || !fn->is_definition || !fn->is_live)
             continue;
 
         if (fn->is_static)
@@ -477,34 +2624,41 @@ static void emit_text(Obj *prog) {
 
         println("\t.text");
         println("%s:", fn->name);
-        current_fn = fn;
-
-        /*  prologue    */
-        println("\tpush\t%%rbp");
-        println("\tmov\t%%rsp, %%rbp");
-        println("\tsub\t$%d, %%rsp", fn->stack_size);
 
-        /*  save passed by register arguments to the stack  */
-        int i = 0;
-        for (Obj *var = fn->params; var; var = var->next)
-            store_gp(i++, var->offset, var->ty->size);
+        /*  at -O the function goes through the peephole optimizer
+            before it reaches the output.   */
+        FILE *out = output_file;
+        char *text;
+        size_t len;
+        output_file = open_memstream(&text, &len);
+        emit_function(fn);
+        fclose(output_file);
+        output_file = out;
 
-        /*  emit code   */
-        gen_stmt(fn->body);
-        assert(depth == 0);
-
-        /* epilogue */
-        println(".L.return.%s:", fn->name);
-        println("\tmov\t%%rbp, %%rsp");
-        println("\tpop\t%%rbp");
-        println("\tret");
+        if (opt_level) {
+            char *opt = peephole(text);
+            free(text);
+            text = opt;
+        }
+        fputs(text, output_file);
+        free(text);
     }
 }
 
 void codegen(Obj *prog, FILE *out) {
     output_file = out;
+    current_prog = prog;
+
+    find_live(prog);
+
+    if (opt_level && !opt_fssa)
+        for (Obj *fn = prog; fn; fn = fn->next)
+            if (fn->is_function && fn->is_definition && fn->is_live)
+                alloc_lvar_regs(fn);
 
     assign_lvar_offsets(prog);
     emit_data(prog);
     emit_text(prog);
+    if (opt_fprofile_generate)
+        emit_profile_runtime();
 }
\ No newline at end of file
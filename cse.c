@@ -0,0 +1,589 @@
+#include "c.h"
+
+/*  common subexpression elimination by local value numbering.
+
+    the statements of a block are scanned in order while a table keeps
+    the expressions whose value is still known.  an expression found in
+    the table is replaced by a read of a local holding its value: either
+    the variable an earlier statement assigned it to, or a temporary that
+    the earlier occurrence now stores into on the way.  an expression
+    that appears twice in one statement is computed into a temporary by
+    a new statement in front of it.
+
+    only statements whose sole side effect is a final store take part,
+    so every value a statement reads is read before memory changes.  a
+    store to a local scalar whose address is never taken forgets the
+    expressions reading that local; any other store forgets everything
+    that loads from memory.  calls, labels and control flow forget the
+    whole table, and nested blocks start with an empty one.          */
+
+typedef struct VarList VarList;
+struct VarList {
+    VarList *next;
+    Obj *var;
+};
+
+/*  an available expression, and the local holding its value or the
+    place of its first occurrence if it has not been saved yet.    */
+typedef struct Value Value;
+struct Value {
+    Value *next;
+    Node *expr;
+    Obj *var;
+    Node **link;
+};
+
+static Obj *current_fn;
+static Node *current_block;
+static VarList *addr_taken;
+static VarList *temps;
+static Value *values;
+
+static void visit(Node *node);
+
+static bool in_list(VarList *list, Obj *var) {
+    for (VarList *v = list; v; v = v->next)
+        if (v->var == var)
+            return true;
+    return false;
+}
+
+static void find_addr_taken(Node *node) {
+    if (!node)
+        return;
+
+    if (node->kind == ND_ADDR) {
+        Node *n = node->lhs;
+        while (n->kind == ND_MEMBER)
+            n = n->lhs;
+        if (n->kind == ND_VAR && n->var->is_local) {
+            VarList *v = calloc(1, sizeof(VarList));
+            v->var = n->var;
+            v->next = addr_taken;
+            addr_taken = v;
+        }
+    }
+
+    find_addr_taken(node->lhs);
+    find_addr_taken(node->rhs);
+    find_addr_taken(node->cond);
+    find_addr_taken(node->then);
+    find_addr_taken(node->els);
+    find_addr_taken(node->init);
+    find_addr_taken(node->inc);
+    for (Node *n = node->body; n; n = n->next)
+        find_addr_taken(n);
+    for (Node *n = node->args; n; n = n->next)
+        find_addr_taken(n);
+}
+
+static bool is_scalar(Type *ty) {
+    return is_integer(ty) || ty->kind == TY_PTR;
+}
+
+/*  a local that only assignments to it can change.  */
+static bool is_private(Obj *var) {
+    return var->is_local && is_scalar(var->ty) && !in_list(addr_taken, var);
+}
+
+/*  true if evaluating 'node' has no side effects.  */
+static bool is_pure(Node *node) {
+    if (!node)
+        return true;
+
+    switch (node->kind) {
+    case ND_ASSIGN:
+    case ND_FUNCALL:
+    case ND_STMT_EXPR:
+    case ND_MEMZERO:
+    case ND_NULL_EXPR:
+        return false;
+    }
+    return is_pure(node->lhs) && is_pure(node->rhs) && is_pure(node->cond) &&
+           is_pure(node->then) && is_pure(node->els);
+}
+
+/*  a scalar value that takes more than a single move to compute.   */
+static bool is_candidate(Node *node) {
+    if (!node->ty || !is_scalar(node->ty) || !is_pure(node))
+        return false;
+
+    Node *n = node;
+    while (n->kind == ND_CAST)
+        n = n->lhs;
+    switch (n->kind) {
+    case ND_NUM:
+    case ND_VAR:
+        return false;
+    case ND_ADDR:
+        return n->lhs->kind != ND_VAR;
+    }
+    return true;
+}
+
+/*  an earlier occurrence may since have been made to save its value.  */
+static Node *unwrap(Node *node) {
+    if (node && node->kind == ND_ASSIGN && node->lhs->kind == ND_VAR &&
+        in_list(temps, node->lhs->var))
+        return node->rhs;
+    return node;
+}
+
+static bool same_value(Node *a, Node *b) {
+    a = unwrap(a);
+    b = unwrap(b);
+    if (!a || !b)
+        return a == b;
+    if (a->kind != b->kind)
+        return false;
+    /*  casts and pointer arithmetic make fresh copies of their types.  */
+    if (a->ty != b->ty && (!a->ty || !b->ty || a->ty->kind != b->ty->kind ||
+                           a->ty->size != b->ty->size))
+        return false;
+
+    switch (a->kind) {
+    case ND_VAR:
+        return a->var == b->var;
+    case ND_NUM:
+        return a->val == b->val;
+    case ND_MEMBER:
+        if (a->member != b->member)
+            return false;
+        break;
+    }
+    return same_value(a->lhs, b->lhs) && same_value(a->rhs, b->rhs) && same_value(a->cond, b->cond) &&
+           same_value(a->then, b->then) && same_value(a->els, b->els);
+}
+
+/*  true if 'node' reads 'var', or any memory if 'var' is NULL.  */
+static bool reads(Node *node, Obj *var) {
+    if (!node)
+        return false;
+
+    switch (node->kind) {
+    case ND_VAR:
+        if (var)
+            return node->var == var;
+        return !is_private(node->var) && node->ty->kind != TY_ARRAY;
+    case ND_DEREF:
+    case ND_MEMBER:
+        if (!var && is_scalar(node->ty))
+            return true;
+        break;
+    }
+    return reads(node->lhs, var) || reads(node->rhs, var) || reads(node->cond, var) ||
+           reads(node->then, var) || reads(node->els, var);
+}
+
+/*  forget what a store to 'var', or to memory if 'var' is NULL, may
+    change.  */
+static void kill(Obj *var) {
+    for (Value **v = &values; *v;) {
+        if (reads((*v)->expr, var) || (var && (*v)->var == var))
+            *v = (*v)->next;
+        else
+            v = &(*v)->next;
+    }
+}
+
+static Node *new_var_node(Obj *var, Token *tok) {
+    Node *node = calloc(1, sizeof(Node));
+    node->kind = ND_VAR;
+    node->tok = tok;
+    node->var = var;
+    node->ty = var->ty;
+    return node;
+}
+
+static Node *new_assign(Obj *var, Node *expr) {
+    Node *node = calloc(1, sizeof(Node));
+    node->kind = ND_ASSIGN;
+    node->tok = expr->tok;
+    node->lhs = new_var_node(var, expr->tok);
+    node->rhs = expr;
+    node->ty = var->ty;
+    return node;
+}
+
+static Obj *new_temp(Type *ty) {
+    Obj *var = calloc(1, sizeof(Obj));
+    var->name = "";
+    var->ty = ty;
+    var->is_local = true;
+    var->scope = current_block;
+    var->next = current_fn->locals;
+    current_fn->locals = var;
+
+    VarList *v = calloc(1, sizeof(VarList));
+    v->var = var;
+    v->next = temps;
+    temps = v;
+    return var;
+}
+
+/*  the local holding the value of 'v', saving it at its first
+    occurrence if needed.    */
+static Obj *value_var(Value *v) {
+    if (!v->var) {
+        v->var = new_temp(v->expr->ty);
+        *v->link = new_assign(v->var, *v->link);
+    }
+    return v->var;
+}
+
+static Value *find_value(Node *node) {
+    for (Value *v = values; v; v = v->next)
+        if (same_value(v->expr, node))
+            return v;
+    return NULL;
+}
+
+static Value *add_value(Node *expr, Obj *var, Node **link) {
+    Value *v = calloc(1, sizeof(Value));
+    v->expr = expr;
+    v->var = var;
+    v->link = link;
+    v->next = values;
+    values = v;
+    return v;
+}
+
+/*
+ *  walking the expressions of a statement
+ */
+
+/*  an occurrence of a candidate, and whether it is evaluated every time
+    the statement runs.     */
+typedef struct Use Use;
+struct Use {
+    Use *next;
+    Node **link;
+    bool always;
+};
+
+static Use *uses;
+
+/*  the address of an indexed element folds into the memory operand
+    that loads it, so it is not worth a register of its own.    */
+static bool is_element_addr(Node *node) {
+    return node->kind == ND_DEREF && (node->lhs->kind == ND_ADD || node->lhs->kind == ND_SUB);
+}
+
+/*  'lvalue' is set where 'node' designates an object instead of
+    computing a value.     */
+static void collect(Node **link, bool always, bool lvalue) {
+    Node *node = *link;
+    if (!node)
+        return;
+
+    if (!lvalue && is_candidate(node)) {
+        Use *u = calloc(1, sizeof(Use));
+        u->link = link;
+        u->always = always;
+        u->next = uses;
+        uses = u;
+    }
+
+    switch (node->kind) {
+    case ND_ASSIGN:
+        collect(&node->lhs, always, true);
+        collect(&node->rhs, always, false);
+        return;
+    case ND_ADDR:
+        collect(&node->lhs, always, true);
+        return;
+    case ND_MEMBER:
+        collect(&node->lhs, always, true);
+        return;
+    case ND_DEREF:
+        if (is_element_addr(node)) {
+            collect(&node->lhs->lhs, always, false);
+            collect(&node->lhs->rhs, always, false);
+            return;
+        }
+        collect(&node->lhs, always, false);
+        return;
+    case ND_COMMA:
+        collect(&node->lhs, always, false);
+        collect(&node->rhs, always, lvalue);
+        return;
+    case ND_COND:
+        collect(&node->cond, always, false);
+        collect(&node->then, false, lvalue);
+        collect(&node->els, false, lvalue);
+        return;
+    case ND_LOGAND:
+    case ND_LOGOR:
+        collect(&node->lhs, always, false);
+        collect(&node->rhs, false, false);
+        return;
+    }
+    collect(&node->lhs, always, false);
+    collect(&node->rhs, always, false);
+}
+
+/*  the occurrences in 'link', in evaluation order.   */
+static Use *collect_uses(Node **link) {
+    uses = NULL;
+    collect(link, true, false);
+
+    Use *list = NULL;
+    while (uses) {
+        Use *u = uses;
+        uses = u->next;
+        u->next = list;
+        list = u;
+    }
+    return list;
+}
+
+/*  replace the outermost expressions whose value is known.  */
+static void replace_known(Node **link, bool lvalue) {
+    Node *node = *link;
+    if (!node)
+        return;
+
+    if (!lvalue && is_candidate(node)) {
+        Value *v = find_value(node);
+        if (v) {
+            *link = new_var_node(value_var(v), node->tok);
+            return;
+        }
+    }
+
+    switch (node->kind) {
+    case ND_ASSIGN:
+    case ND_ADDR:
+    case ND_MEMBER:
+        replace_known(&node->lhs, true);
+        replace_known(&node->rhs, false);
+        return;
+    case ND_DEREF:
+        if (is_element_addr(node)) {
+            replace_known(&node->lhs->lhs, false);
+            replace_known(&node->lhs->rhs, false);
+            return;
+        }
+        break;
+    case ND_COMMA:
+        replace_known(&node->lhs, false);
+        replace_known(&node->rhs, lvalue);
+        return;
+    case ND_COND:
+        replace_known(&node->cond, false);
+        replace_known(&node->then, lvalue);
+        replace_known(&node->els, lvalue);
+        return;
+    }
+    replace_known(&node->lhs, false);
+    replace_known(&node->rhs, false);
+}
+
+/*
+ *  statements
+ */
+
+/*  a chain of comma-separated steps, each of them pure, a store whose
+    operands are pure, or the clearing of a local.  */
+static bool is_simple(Node *node) {
+    switch (node->kind) {
+    case ND_COMMA:
+        return is_simple(node->lhs) && is_simple(node->rhs);
+    case ND_MEMZERO:
+        return true;
+    case ND_ASSIGN:
+        return is_pure(node->lhs) && is_pure(node->rhs);
+    case ND_CAST:
+        return is_simple(node->lhs);
+    case ND_ADD:
+    case ND_SUB:
+        /*  the value of 'i++' is the new value minus one.  */
+        if (node->rhs->kind == ND_NUM)
+            return is_simple(node->lhs);
+        break;
+    }
+    return is_pure(node);
+}
+
+static int find_steps(Node **link, Node ***steps, int n) {
+    Node *node = *link;
+    switch (node->kind) {
+    case ND_COMMA:
+        n = find_steps(&node->lhs, steps, n);
+        return find_steps(&node->rhs, steps, n);
+    case ND_CAST:
+        if (!is_pure(node))
+            return find_steps(&node->lhs, steps, n);
+        break;
+    case ND_ADD:
+    case ND_SUB:
+        if (!is_pure(node) && node->rhs->kind == ND_NUM)
+            return find_steps(&node->lhs, steps, n);
+        break;
+    }
+    if (n < 64)
+        steps[n] = link;
+    return n + 1;
+}
+
+/*  enter the values one step of a statement computes and forget those
+    its store changes.    */
+static void record(Node **link) {
+    for (Use *u = collect_uses(link); u; u = u->next)
+        if (u->always && !find_value(*u->link))
+            add_value(*u->link, NULL, u->link);
+
+    Node *node = *link;
+    if (node->kind == ND_MEMZERO) {
+        kill(is_private(node->var) ? node->var : NULL);
+        return;
+    }
+    if (node->kind != ND_ASSIGN)
+        return;
+
+    Node *lhs = node->lhs;
+    if (lhs->kind != ND_VAR || !is_private(lhs->var)) {
+        kill(NULL);
+        return;
+    }
+
+    kill(lhs->var);
+    if (!is_candidate(node->rhs) || reads(node->rhs, lhs->var))
+        return;
+
+    /*  the local itself holds the value from now on.  */
+    Value *v = find_value(node->rhs);
+    if (!v)
+        add_value(node->rhs, lhs->var, &node->rhs);
+    else if (!v->var)
+        v->var = lhs->var;
+}
+
+/*  compute an expression that the statement at '*stmt' evaluates twice
+    into a temporary by a new statement in front of it.   */
+static bool hoist_duplicate(Node ***stmt, Node **link) {
+    Use *list = collect_uses(link);
+
+    for (Use *u = list; u; u = u->next) {
+        int n = 0;
+        bool always = false;
+        for (Use *w = list; w; w = w->next) {
+            if (same_value(*w->link, *u->link)) {
+                n++;
+                always |= w->always;
+            }
+        }
+        if (n < 2 || !always)
+            continue;
+
+        Node *expr = *u->link;
+        Obj *var = new_temp(expr->ty);
+        for (Use *w = list; w; w = w->next)
+            if (w == u || same_value(*w->link, expr))
+                *w->link = new_var_node(var, expr->tok);
+
+        Node *def = calloc(1, sizeof(Node));
+        def->kind = ND_EXPR_STMT;
+        def->tok = expr->tok;
+        def->lhs = new_assign(var, expr);
+        def->next = **stmt;
+        **stmt = def;
+        *stmt = &def->next;
+
+        record(&def->lhs);
+        return true;
+    }
+    return false;
+}
+
+/*  returns false for a statement that ends the current stretch of
+    straight-line code.   */
+static bool simple_stmt(Node ***stmt) {
+    Node *node = **stmt;
+    if ((node->kind != ND_EXPR_STMT && node->kind != ND_RETURN) || !node->lhs ||
+        !is_simple(node->lhs))
+        return false;
+
+    Node **steps[64];
+    int n = find_steps(&node->lhs, steps, 0);
+    if (n > 64)
+        return false;
+
+    for (int i = 0; i < n; i++) {
+        replace_known(steps[i], false);
+
+        /*  only a lone step may be computed ahead of the statement.  */
+        while (n == 1 && hoist_duplicate(stmt, steps[i]))
+            replace_known(steps[i], false);
+
+        record(steps[i]);
+    }
+    return true;
+}
+
+/*  forget the locals of a block that has ended.  */
+static void leave_block(Node *block) {
+    for (Value **v = &values; *v;) {
+        if ((*v)->var && (*v)->var->scope == block)
+            *v = (*v)->next;
+        else
+            v = &(*v)->next;
+    }
+}
+
+static void visit_list(Node **head) {
+    for (Node **link = head; *link; link = &(*link)->next) {
+        Node *node = *link;
+
+        /*  control falls into a nested block and out of it again.  */
+        if (node->kind == ND_BLOCK) {
+            visit_list(&node->body);
+            leave_block(node);
+            continue;
+        }
+
+        if (!simple_stmt(&link)) {
+            values = NULL;
+            visit(node);
+            values = NULL;
+        }
+    }
+}
+
+static void visit(Node *node) {
+    if (!node)
+        return;
+
+    if (node->kind == ND_BLOCK || node->kind == ND_STMT_EXPR) {
+        Value *saved = values;
+        Node *block = current_block;
+        values = NULL;
+        current_block = node;
+        visit_list(&node->body);
+        values = saved;
+        current_block = block;
+        return;
+    }
+
+    visit(node->lhs);
+    visit(node->rhs);
+    visit(node->cond);
+    visit(node->then);
+    visit(node->els);
+    visit(node->init);
+    visit(node->inc);
+    for (Node *n = node->args; n; n = n->next)
+        visit(n);
+}
+
+void eliminate_common_subexprs(Obj *prog) {
+    for (Obj *fn = prog; fn; fn = fn->next) {
+        if (!fn->is_function || !fn->is_definition)
+            continue;
+
+        current_fn = fn;
+        addr_taken = NULL;
+        find_addr_taken(fn->body);
+        visit(fn->body);
+    }
+}
@@ -0,0 +1,349 @@
+#include "c.h"
+
+/*  constant folding and algebraic simplification.
+
+    runs over the typed AST of every function.  a subtree whose operands
+    are all integer literals becomes a single literal of the type
+    add_type gave it, truncated and sign-extended the way codegen would
+    leave it in %rax.  identities such as x+0, x*1 and x&-1 drop the
+    constant operand, and x*0 and x&0 become 0 when x has no side
+    effects.  a condition known at compile time selects its live arm as
+    long as the dead one holds no label a jump could still reach.  the
+    length of a string literal passed to strlen is known as well.      */
+
+static Obj *prog;
+
+static Node *fold(Node *node);
+
+static Node *new_num(int64_t val, Node *orig) {
+    Node *node = calloc(1, sizeof(Node));
+    node->kind = ND_NUM;
+    node->tok = orig->tok;
+    node->val = val;
+    node->ty = orig->ty;
+    return node;
+}
+
+static bool is_num(Node *node) {
+    return node->kind == ND_NUM && is_integer(node->ty);
+}
+
+static bool is_const(Node *node, int64_t val) {
+    return is_num(node) && node->val == val;
+}
+
+/*  truncate a value to the size of 'ty' and sign-extend it back.  */
+static int64_t wrap(int64_t val, Type *ty) {
+    if (ty->kind == TY_BOOL)
+        return val != 0;
+
+    switch (ty->size) {
+    case 1: return (int8_t)val;
+    case 2: return (int16_t)val;
+    case 4: return (int32_t)val;
+    }
+    return val;
+}
+
+static bool same_type(Type *a, Type *b) {
+    if (a->kind == TY_PTR || b->kind == TY_PTR)
+        return a->kind == b->kind;
+    return a->kind == b->kind && a->size == b->size;
+}
+
+/*  true if evaluating a node cannot change the state of the program.  */
+static bool is_pure(Node *node) {
+    if (!node)
+        return true;
+
+    switch (node->kind) {
+    case ND_NUM:
+    case ND_VAR:
+        return true;
+    case ND_ASSIGN:
+    case ND_FUNCALL:
+    case ND_STMT_EXPR:
+    case ND_MEMZERO:
+        return false;
+    }
+    return is_pure(node->lhs) && is_pure(node->rhs) && is_pure(node->cond) &&
+           is_pure(node->then) && is_pure(node->els);
+}
+
+/*  true if a node contains a jump target, which keeps it alive even
+    when control cannot fall into it.   */
+static bool has_label(Node *node) {
+    if (!node)
+        return false;
+    if (node->kind == ND_LABEL || node->kind == ND_CASE)
+        return true;
+
+    if (has_label(node->lhs) || has_label(node->rhs) || has_label(node->cond) ||
+        has_label(node->then) || has_label(node->els) || has_label(node->init) ||
+        has_label(node->inc))
+        return true;
+    for (Node *n = node->body; n; n = n->next)
+        if (has_label(n))
+            return true;
+    return false;
+}
+
+/*  strlen("literal") unless the program defines its own strlen.  */
+static Node *fold_call(Node *node) {
+    if (strcmp(node->funcname, "strlen") || !node->args || node->args->next ||
+        !is_integer(node->ty))
+        return node;
+
+    Node *arg = node->args;
+    while (arg->kind == ND_CAST)
+        arg = arg->lhs;
+    if (arg->kind != ND_VAR || arg->var->is_local || !arg->var->init_data ||
+        strncmp(arg->var->name, ".L..", 4) || arg->ty->kind != TY_ARRAY ||
+        arg->ty->base->kind != TY_CHAR)
+        return node;
+
+    for (Obj *fn = prog; fn; fn = fn->next)
+        if (fn->is_function && fn->is_definition && !strcmp(fn->name, "strlen"))
+            return node;
+    return new_num(strnlen(arg->var->init_data, arg->ty->size), node);
+}
+
+/*  a condition only tests against zero, so '!!x' can be 'x'.   */
+static Node *fold_cond(Node *node) {
+    node = fold(node);
+    while (node && node->kind == ND_NOT && node->lhs->kind == ND_NOT)
+        node = node->lhs->lhs;
+    return node;
+}
+
+static Node *fold_binary(Node *node) {
+    Node *lhs = node->lhs;
+    Node *rhs = node->rhs;
+
+    if (is_num(lhs) && is_num(rhs) && is_integer(node->ty)) {
+        uint64_t l = lhs->val;
+        uint64_t r = rhs->val;
+        int bits = node->ty->size * 8;
+
+        switch (node->kind) {
+        case ND_ADD: return new_num(wrap(l + r, node->ty), node);
+        case ND_SUB: return new_num(wrap(l - r, node->ty), node);
+        case ND_MUL: return new_num(wrap(l * r, node->ty), node);
+        case ND_DIV:
+        case ND_MOD:
+            /*  leave the trap to run time.  */
+            if (rhs->val == 0 || rhs->val == -1)
+                break;
+            if (node->kind == ND_DIV)
+                return new_num(wrap(lhs->val / rhs->val, node->ty), node);
+            return new_num(wrap(lhs->val % rhs->val, node->ty), node);
+        case ND_BITAND: return new_num(wrap(l & r, node->ty), node);
+        case ND_BITOR:  return new_num(wrap(l | r, node->ty), node);
+        case ND_BITXOR: return new_num(wrap(l ^ r, node->ty), node);
+        case ND_SHL:
+            if (rhs->val < 0 || rhs->val >= bits)
+                break;
+            return new_num(wrap(l << r, node->ty), node);
+        case ND_SHR:
+            if (rhs->val < 0 || rhs->val >= bits)
+                break;
+            return new_num(wrap(lhs->val >> r, node->ty), node);
+        case ND_EQ: return new_num(lhs->val == rhs->val, node);
+        case ND_NE: return new_num(lhs->val != rhs->val, node);
+        case ND_LT: return new_num(lhs->val < rhs->val, node);
+        case ND_LE: return new_num(lhs->val <= rhs->val, node);
+        }
+        return node;
+    }
+
+    /*  the surviving operand must already have the type of the result. */
+    bool keep_lhs = same_type(lhs->ty, node->ty);
+    bool keep_rhs = same_type(rhs->ty, node->ty);
+
+    switch (node->kind) {
+    case ND_ADD:
+    case ND_BITOR:
+    case ND_BITXOR:
+        if (is_const(rhs, 0) && keep_lhs)
+            return lhs;
+        if (is_const(lhs, 0) && keep_rhs)
+            return rhs;
+        break;
+    case ND_SUB:
+    case ND_SHL:
+    case ND_SHR:
+        if (is_const(rhs, 0) && keep_lhs)
+            return lhs;
+        break;
+    case ND_MUL:
+        if (is_const(rhs, 1) && keep_lhs)
+            return lhs;
+        if (is_const(lhs, 1) && keep_rhs)
+            return rhs;
+        if (is_const(rhs, 0) && is_pure(lhs))
+            return new_num(0, node);
+        if (is_const(lhs, 0) && is_pure(rhs))
+            return new_num(0, node);
+        break;
+    case ND_DIV:
+        if (is_const(rhs, 1) && keep_lhs)
+            return lhs;
+        break;
+    case ND_BITAND:
+        if (is_const(rhs, -1) && keep_lhs)
+            return lhs;
+        if (is_const(lhs, -1) && keep_rhs)
+            return rhs;
+        if (is_const(rhs, 0) && is_pure(lhs))
+            return new_num(0, node);
+        if (is_const(lhs, 0) && is_pure(rhs))
+            return new_num(0, node);
+        break;
+    }
+    return node;
+}
+
+static Node *fold_expr(Node *node) {
+    switch (node->kind) {
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_MOD:
+    case ND_BITAND:
+    case ND_BITOR:
+    case ND_BITXOR:
+    case ND_SHL:
+    case ND_SHR:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LT:
+    case ND_LE:
+        return fold_binary(node);
+    case ND_NEG:
+        if (is_num(node->lhs))
+            return new_num(wrap(-(uint64_t)node->lhs->val, node->ty), node);
+        return node;
+    case ND_BITNOT:
+        if (is_num(node->lhs))
+            return new_num(wrap(~node->lhs->val, node->ty), node);
+        return node;
+    case ND_NOT:
+        if (is_num(node->lhs))
+            return new_num(!node->lhs->val, node);
+        return node;
+    case ND_CAST:
+        if (!is_integer(node->ty) || !is_integer(node->lhs->ty))
+            return node;
+        if (is_num(node->lhs))
+            return new_num(wrap(node->lhs->val, node->ty), node);
+        /*  a cast between identical integer types emits nothing.  */
+        if (node->ty->kind == node->lhs->ty->kind && node->ty->kind != TY_BOOL)
+            return node->lhs;
+        return node;
+    case ND_COND:
+        if (is_num(node->cond)) {
+            Node *live = node->cond->val ? node->then : node->els;
+            Node *dead = node->cond->val ? node->els : node->then;
+            if (!has_label(dead))
+                return live;
+        }
+        return node;
+    case ND_LOGAND:
+    case ND_LOGOR:
+        if (is_num(node->lhs)) {
+            bool lhs = node->lhs->val != 0;
+            /*  the right operand is never evaluated.  */
+            if (lhs == (node->kind == ND_LOGOR) && !has_label(node->rhs))
+                return new_num(lhs, node);
+            if (is_num(node->rhs))
+                return new_num(node->rhs->val != 0, node);
+        }
+        return node;
+    case ND_COMMA:
+        if (is_pure(node->lhs))
+            return node->rhs;
+        return node;
+    case ND_FUNCALL:
+        return fold_call(node);
+    }
+    return node;
+}
+
+static Node *fold_stmt(Node *node) {
+    switch (node->kind) {
+    case ND_IF:
+        if (is_num(node->cond)) {
+            Node *live = node->cond->val ? node->then : node->els;
+            Node *dead = node->cond->val ? node->els : node->then;
+            if (has_label(dead))
+                return node;
+            if (live)
+                return live;
+
+            Node *empty = calloc(1, sizeof(Node));
+            empty->kind = ND_BLOCK;
+            empty->tok = node->tok;
+            return empty;
+        }
+        return node;
+    case ND_FOR:
+        /*  'for (;;)' needs no test.  */
+        if (node->cond && is_num(node->cond) && node->cond->val)
+            node->cond = NULL;
+        return node;
+    }
+    return node;
+}
+
+static Node *fold(Node *node) {
+    if (!node)
+        return NULL;
+
+    switch (node->kind) {
+    case ND_IF:
+    case ND_FOR:
+    case ND_COND:
+        node->cond = fold_cond(node->cond);
+        break;
+    case ND_NOT:
+    case ND_LOGAND:
+    case ND_LOGOR:
+        node->lhs = fold_cond(node->lhs);
+        node->rhs = fold_cond(node->rhs);
+        break;
+    case ND_SWITCH:
+        node->cond = fold(node->cond);
+        break;
+    }
+
+    if (node->kind != ND_NOT && node->kind != ND_LOGAND && node->kind != ND_LOGOR) {
+        node->lhs = fold(node->lhs);
+        node->rhs = fold(node->rhs);
+    }
+    node->then = fold(node->then);
+    node->els = fold(node->els);
+    node->init = fold(node->init);
+    node->inc = fold(node->inc);
+
+    for (Node **p = &node->body; *p; p = &(*p)->next) {
+        Node *next = (*p)->next;
+        *p = fold(*p);
+        (*p)->next = next;
+    }
+    for (Node **p = &node->args; *p; p = &(*p)->next) {
+        Node *next = (*p)->next;
+        *p = fold(*p);
+        (*p)->next = next;
+    }
+
+    node = fold_stmt(node);
+    return fold_expr(node);
+}
+
+void fold_constants(Obj *p) {
+    prog = p;
+    for (Obj *fn = prog; fn; fn = fn->next)
+        if (fn->is_function && fn->is_definition)
+            fn->body = fold(fn->body);
+}
@@ -0,0 +1,349 @@
+#include "c.h"
+
+/*  inlining of small static functions.
+
+    a call of a static function defined in this file whose body is
+    smaller than INLINE_MAX_NODES becomes a statement expression holding
+    a copy of that body.  the callee's parameters and locals are cloned
+    into the caller, the arguments are assigned to the cloned parameters
+    in order, and every label gets a fresh name.  a 'return' that is not
+    the last statement stores its value into a result variable and jumps
+    to the end of the copy.  calls inside the copy are left alone, so a
+    recursive callee is expanded at most once per call site.
+
+    with a profile, a call that never ran is left alone, and one that
+    ran at least as often as its caller was entered may take a callee of
+    up to INLINE_HOT_MAX_NODES.     */
+
+#define INLINE_MAX_NODES 40
+#define INLINE_HOT_MAX_NODES 160
+
+typedef struct VarMap VarMap;
+struct VarMap {
+    VarMap *next;
+    Obj *from;
+    Obj *to;
+};
+
+typedef struct LabelMap LabelMap;
+struct LabelMap {
+    LabelMap *next;
+    char *from;
+    char *to;
+};
+
+static Obj *prog;
+static Obj *caller;
+static Obj *callee;
+static VarMap *vars;
+static LabelMap *labels;
+static Obj *ret_var;
+static char *ret_label;
+static Node *last_return;
+
+static Obj *find_function(char *name) {
+    for (Obj *fn = prog; fn; fn = fn->next)
+        if (fn->is_function && !strcmp(fn->name, name))
+            return fn;
+    return NULL;
+}
+
+static char *new_label(void) {
+    static int id = 0;
+    return format(".L..inline.%d", id++);
+}
+
+static Obj *map_var(Obj *var) {
+    for (VarMap *m = vars; m; m = m->next)
+        if (m->from == var)
+            return m->to;
+    return var;
+}
+
+/*  labels are unique strings, so one table covers goto targets and the
+    break and continue labels of loops.     */
+static char *map_label(char *label) {
+    if (!label)
+        return NULL;
+    for (LabelMap *m = labels; m; m = m->next)
+        if (m->from == label)
+            return m->to;
+
+    LabelMap *m = calloc(1, sizeof(LabelMap));
+    m->from = label;
+    m->to = new_label();
+    m->next = labels;
+    labels = m;
+    return m->to;
+}
+
+static Node *new_node(NodeKind kind, Token *tok) {
+    Node *node = calloc(1, sizeof(Node));
+    node->kind = kind;
+    node->tok = tok;
+    return node;
+}
+
+static Node *new_var_node(Obj *var, Token *tok) {
+    Node *node = new_node(ND_VAR, tok);
+    node->var = var;
+    return node;
+}
+
+static Node *new_assign(Obj *var, Node *expr, Token *tok) {
+    Node *node = new_node(ND_ASSIGN, tok);
+    node->lhs = new_var_node(var, tok);
+    node->rhs = expr;
+    add_type(node);
+
+    Node *stmt = new_node(ND_EXPR_STMT, tok);
+    stmt->lhs = node;
+    return stmt;
+}
+
+/*  the number of nodes in a subtree, or INLINE_HOT_MAX_NODES + 1 if it
+    contains something the inliner does not copy.   */
+static int cost(Node *node) {
+    if (!node)
+        return 0;
+
+    switch (node->kind) {
+    case ND_SWITCH:
+    case ND_CASE:
+        return INLINE_HOT_MAX_NODES + 1;
+    case ND_FUNCALL:
+        if (!strcmp(node->funcname, callee->name))
+            return INLINE_HOT_MAX_NODES + 1;
+        break;
+    }
+
+    int n = 1 + cost(node->lhs) + cost(node->rhs) + cost(node->cond) +
+            cost(node->then) + cost(node->els) + cost(node->init) + cost(node->inc);
+    for (Node *m = node->body; m; m = m->next)
+        n += cost(m);
+    for (Node *m = node->args; m; m = m->next)
+        n += cost(m);
+    return n;
+}
+
+static bool can_inline(Obj *fn, Node *call) {
+    if (!fn || fn == caller || !fn->is_static || !fn->is_definition || !fn->body)
+        return false;
+
+    Type *ty = fn->ty->return_ty;
+    if (ty->kind == TY_STRUCT || ty->kind == TY_UNION)
+        return false;
+
+    /*  an argument without a parameter would not be evaluated.   */
+    int nparams = 0, nargs = 0;
+    for (Obj *var = fn->params; var; var = var->next)
+        nparams++;
+    for (Node *arg = call->args; arg; arg = arg->next)
+        nargs++;
+    if (nparams != nargs)
+        return false;
+
+    int limit = INLINE_MAX_NODES;
+    int64_t calls = profile_count(call, 0);
+    if (calls == 0)
+        return false;
+    if (calls > 0 && calls >= profile_count(caller->body, 0))
+        limit = INLINE_HOT_MAX_NODES;
+
+    callee = fn;
+    return cost(fn->body) <= limit;
+}
+
+static Node *clone(Node *node);
+
+static Node *clone_list(Node *node) {
+    Node head = {};
+    Node *cur = &head;
+    for (Node *n = node; n; n = n->next)
+        cur = cur->next = clone(n);
+    return head.next;
+}
+
+static Node *clone(Node *node) {
+    if (!node)
+        return NULL;
+
+    if (node->kind == ND_RETURN) {
+        /*  the last statement of the body leaves its value behind.  */
+        if (node == last_return) {
+            Node *stmt = new_node(ND_EXPR_STMT, node->tok);
+            stmt->lhs = clone(node->lhs);
+            return stmt;
+        }
+
+        Node *blk = new_node(ND_BLOCK, node->tok);
+        Node *jmp = new_node(ND_GOTO, node->tok);
+        jmp->unique_label = ret_label;
+        if (ret_var) {
+            blk->body = new_assign(ret_var, clone(node->lhs), node->tok);
+            blk->body->next = jmp;
+        } else {
+            /*  a void function still evaluates the returned expression. */
+            Node *stmt = new_node(ND_EXPR_STMT, node->tok);
+            stmt->lhs = clone(node->lhs);
+            blk->body = stmt;
+            stmt->next = jmp;
+        }
+        return blk;
+    }
+
+    Node *n = calloc(1, sizeof(Node));
+    *n = *node;
+    n->next = NULL;
+    n->lhs = clone(node->lhs);
+    n->rhs = clone(node->rhs);
+    n->cond = clone(node->cond);
+    n->then = clone(node->then);
+    n->els = clone(node->els);
+    n->init = clone(node->init);
+    n->inc = clone(node->inc);
+    n->body = clone_list(node->body);
+    n->args = clone_list(node->args);
+
+    n->brk_label = map_label(node->brk_label);
+    n->cont_label = map_label(node->cont_label);
+    n->unique_label = map_label(node->unique_label);
+    if (node->var)
+        n->var = map_var(node->var);
+    return n;
+}
+
+/*  the statements of the callee's body, and the 'return' that ends it.  */
+static Node *body_stmts(Node **last) {
+    Node *body = callee->body;
+    Node *stmts = (body->kind == ND_BLOCK) ? body->body : body;
+
+    *last = NULL;
+    for (Node *n = stmts; n; n = n->next)
+        if (!n->next && n->kind == ND_RETURN)
+            *last = n;
+    return stmts;
+}
+
+static int count_returns(Node *node) {
+    if (!node)
+        return 0;
+
+    int n = (node->kind == ND_RETURN);
+    n += count_returns(node->lhs) + count_returns(node->rhs) + count_returns(node->cond) +
+         count_returns(node->then) + count_returns(node->els) + count_returns(node->init) +
+         count_returns(node->inc);
+    for (Node *m = node->body; m; m = m->next)
+        n += count_returns(m);
+    return n;
+}
+
+static Obj *new_local(char *name, Type *ty) {
+    Obj *var = calloc(1, sizeof(Obj));
+    var->name = name;
+    var->ty = ty;
+    var->is_local = true;
+    var->next = caller->locals;
+    caller->locals = var;
+    return var;
+}
+
+static Node *expand(Node *call) {
+    Obj *outer = caller->locals;
+    vars = NULL;
+    labels = NULL;
+    ret_var = NULL;
+
+    for (Obj *var = callee->locals; var; var = var->next) {
+        VarMap *m = calloc(1, sizeof(VarMap));
+        m->from = var;
+        m->to = new_local(var->name, var->ty);
+        m->next = vars;
+        vars = m;
+    }
+
+    Node head = {};
+    Node *cur = &head;
+
+    Node *arg = call->args;
+    for (Obj *param = callee->params; param && arg; param = param->next) {
+        Node *next = arg->next;
+        arg->next = NULL;
+        cur = cur->next = new_assign(map_var(param), arg, call->tok);
+        arg = next;
+    }
+
+    /*  with a single 'return' at the end, the copy simply ends with
+        its value.  otherwise every 'return' jumps to the end.     */
+    Node *stmts = body_stmts(&last_return);
+    int nreturns = count_returns(callee->body);
+    ret_label = new_label();
+    if (call->ty->kind == TY_VOID || nreturns > (last_return ? 1 : 0))
+        last_return = NULL;
+    if (!last_return && nreturns && call->ty->kind != TY_VOID)
+        ret_var = new_local(format("%s.ret", callee->name), call->ty);
+
+    for (Node *n = stmts; n; n = n->next)
+        cur = cur->next = clone(n);
+
+    if (!last_return && nreturns) {
+        Node *label = new_node(ND_LABEL, call->tok);
+        label->unique_label = ret_label;
+        label->lhs = new_node(ND_BLOCK, call->tok);
+        cur = cur->next = label;
+
+        if (ret_var) {
+            Node *val = new_node(ND_EXPR_STMT, call->tok);
+            val->lhs = new_var_node(ret_var, call->tok);
+            add_type(val->lhs);
+            cur = cur->next = val;
+        }
+    }
+
+    Node *node = new_node(ND_STMT_EXPR, call->tok);
+    node->body = head.next;
+    node->ty = call->ty;
+
+    /*  the copies live only as long as the expression.  */
+    for (Obj *var = caller->locals; var != outer; var = var->next)
+        var->scope = node;
+    return node;
+}
+
+static Node *inline_calls(Node *node) {
+    if (!node)
+        return NULL;
+
+    node->lhs = inline_calls(node->lhs);
+    node->rhs = inline_calls(node->rhs);
+    node->cond = inline_calls(node->cond);
+    node->then = inline_calls(node->then);
+    node->els = inline_calls(node->els);
+    node->init = inline_calls(node->init);
+    node->inc = inline_calls(node->inc);
+
+    for (Node **p = &node->body; *p; p = &(*p)->next) {
+        Node *next = (*p)->next;
+        *p = inline_calls(*p);
+        (*p)->next = next;
+    }
+    for (Node **p = &node->args; *p; p = &(*p)->next) {
+        Node *next = (*p)->next;
+        *p = inline_calls(*p);
+        (*p)->next = next;
+    }
+
+    if (node->kind == ND_FUNCALL && can_inline(find_function(node->funcname), node))
+        return expand(node);
+    return node;
+}
+
+void inline_functions(Obj *p) {
+    prog = p;
+    for (Obj *fn = prog; fn; fn = fn->next) {
+        if (!fn->is_function || !fn->is_definition)
+            continue;
+        caller = fn;
+        fn->body = inline_calls(fn->body);
+    }
+}
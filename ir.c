@@ -0,0 +1,934 @@
+#include "c.h"
+
+/*  SSA intermediate representation.
+
+    a function body is lowered into basic blocks of three-address
+    instructions.  locals start out in stack slots addressed by IR_LADDR;
+    mem2reg then promotes every scalar local whose address never escapes
+    into SSA values, placing phi nodes on the iterated dominance frontier
+    of its stores (Cytron et al.).                                      */
+
+/*  the block a label starts    */
+typedef struct LabelBB LabelBB;
+struct LabelBB {
+    LabelBB *next;
+    char *label;
+    BB *bb;
+};
+
+static IRFunc *cur_fn;
+static BB *cur_bb;
+static BB *bb_tail;
+static LabelBB *label_bbs;
+
+static Ins *lower_expr(Node *node);
+static Ins *lower_stmt(Node *node);
+
+BB *new_bb(void) {
+    /*  block ids double as assembly labels, so keep them unique.   */
+    static int id;
+    BB *bb = calloc(1, sizeof(BB));
+    bb->id = id++;
+    return bb;
+}
+
+static Ins *new_ins(IRKind kind, int size) {
+    Ins *ins = calloc(1, sizeof(Ins));
+    ins->kind = kind;
+    ins->size = size;
+    ins->id = cur_fn->nvals++;
+    ins->bb = cur_bb;
+
+    if (cur_bb->last)
+        cur_bb->last->next = ins;
+    else
+        cur_bb->ins = ins;
+    cur_bb->last = ins;
+    return ins;
+}
+
+static void add_op(Ins *ins, Ins *op) {
+    ins->ops = realloc(ins->ops, sizeof(Ins *) * (ins->nops + 1));
+    ins->ops[ins->nops++] = op;
+}
+
+static Ins *new_unary(IRKind kind, int size, Ins *lhs) {
+    Ins *ins = new_ins(kind, size);
+    add_op(ins, lhs);
+    return ins;
+}
+
+static Ins *new_binary(IRKind kind, int size, Ins *lhs, Ins *rhs) {
+    Ins *ins = new_ins(kind, size);
+    add_op(ins, lhs);
+    add_op(ins, rhs);
+    return ins;
+}
+
+static Ins *new_imm(int64_t val) {
+    Ins *ins = new_ins(IR_IMM, 8);
+    ins->val = val;
+    return ins;
+}
+
+static bool is_terminator(Ins *ins) {
+    return ins && (ins->kind == IR_JMP || ins->kind == IR_BR || ins->kind == IR_RET);
+}
+
+int get_succs(BB *bb, BB **succs) {
+    Ins *ins = bb->last;
+    if (ins->kind == IR_JMP) {
+        succs[0] = ins->then;
+        return 1;
+    }
+    if (ins->kind == IR_BR) {
+        succs[0] = ins->then;
+        succs[1] = ins->els;
+        return 2;
+    }
+    return 0;
+}
+
+static void jump(BB *bb) {
+    new_ins(IR_JMP, 0)->then = bb;
+}
+
+static void branch(Ins *cond, BB *then, BB *els) {
+    Ins *ins = new_unary(IR_BR, 8, cond);
+    ins->then = then;
+    ins->els = els;
+}
+
+/*  make 'bb' the current block, falling through from the previous one.  */
+static void start_bb(BB *bb) {
+    if (!is_terminator(cur_bb->last))
+        jump(bb);
+    bb_tail = bb_tail->next = bb;
+    cur_bb = bb;
+}
+
+static BB *label_bb(char *label) {
+    for (LabelBB *l = label_bbs; l; l = l->next)
+        if (!strcmp(l->label, label))
+            return l->bb;
+
+    LabelBB *l = calloc(1, sizeof(LabelBB));
+    l->label = label;
+    l->bb = new_bb();
+    l->next = label_bbs;
+    label_bbs = l;
+    return l->bb;
+}
+
+/*  a fresh local holding the value of ?:, && or ||, to be promoted later.  */
+static Obj *new_temp(void) {
+    Obj *var = calloc(1, sizeof(Obj));
+    var->name = "";
+    var->ty = ty_long;
+    var->is_local = true;
+    var->next = cur_fn->fn->locals;
+    cur_fn->fn->locals = var;
+    return var;
+}
+
+static int op_size(Type *ty) {
+    return (ty->kind == TY_LONG || ty->base) ? 8 : 4;
+}
+
+static Ins *var_addr(Obj *var) {
+    Ins *ins = new_ins(var->is_local ? IR_LADDR : IR_GADDR, 8);
+    ins->var = var;
+    return ins;
+}
+
+static Ins *lower_load(Type *ty, Ins *addr) {
+    if (ty->kind == TY_ARRAY || ty->kind == TY_STRUCT || ty->kind == TY_UNION)
+        return addr;
+    return new_unary(IR_LOAD, ty->size, addr);
+}
+
+static void lower_store(Type *ty, Ins *addr, Ins *val) {
+    if (ty->kind == TY_STRUCT || ty->kind == TY_UNION || ty->kind == TY_ARRAY)
+        new_binary(IR_MEMCPY, ty->size, addr, val);
+    else
+        new_binary(IR_STORE, ty->size, addr, val);
+}
+
+static Ins *lower_addr(Node *node) {
+    switch (node->kind) {
+    case ND_VAR:
+        return var_addr(node->var);
+    case ND_DEREF:
+        return lower_expr(node->lhs);
+    case ND_COMMA:
+        lower_expr(node->lhs);
+        return lower_addr(node->rhs);
+    case ND_MEMBER:
+        return new_binary(IR_ADD, 8, lower_addr(node->lhs), new_imm(node->member->offset));
+    }
+    error_tok(node->tok, "not an lvalue");
+}
+
+static Ins *lower_cast(Ins *val, Type *from, Type *to) {
+    if (to->kind == TY_VOID)
+        return val;
+    if (to->kind == TY_BOOL)
+        return new_binary(IR_NE, 8, val, new_imm(0));
+    if (is_integer(to) && to->size < 8 && !(is_integer(from) && from->size <= to->size))
+        return new_unary(IR_SEXT, to->size, val);
+    return val;
+}
+
+static Ins *lower_logical(Node *node) {
+    BB *rhs = new_bb();
+    BB *other = new_bb();
+    BB *end = new_bb();
+    Obj *tmp = new_temp();
+    bool is_and = node->kind == ND_LOGAND;
+
+    if (is_and)
+        branch(lower_expr(node->lhs), rhs, other);
+    else
+        branch(lower_expr(node->lhs), other, rhs);
+
+    start_bb(rhs);
+    Ins *val = new_binary(IR_NE, 8, lower_expr(node->rhs), new_imm(0));
+    lower_store(ty_long, var_addr(tmp), val);
+    jump(end);
+
+    start_bb(other);
+    lower_store(ty_long, var_addr(tmp), new_imm(!is_and));
+
+    start_bb(end);
+    return lower_load(ty_long, var_addr(tmp));
+}
+
+static Ins *lower_expr(Node *node) {
+    switch (node->kind) {
+    case ND_NULL_EXPR:
+        return new_imm(0);
+    case ND_NUM:
+        return new_imm(node->val);
+    case ND_NEG:
+        return new_unary(IR_NEG, op_size(node->ty), lower_expr(node->lhs));
+    case ND_VAR:
+    case ND_MEMBER:
+        return lower_load(node->ty, lower_addr(node));
+    case ND_DEREF:
+        return lower_load(node->ty, lower_expr(node->lhs));
+    case ND_ADDR:
+        return lower_addr(node->lhs);
+    case ND_ASSIGN: {
+        Ins *addr = lower_addr(node->lhs);
+        Ins *val = lower_expr(node->rhs);
+        lower_store(node->ty, addr, val);
+        return val;
+    }
+    case ND_STMT_EXPR: {
+        Ins *val = NULL;
+        for (Node *n = node->body; n; n = n->next)
+            val = lower_stmt(n);
+        return val ? val : new_imm(0);
+    }
+    case ND_COMMA:
+        lower_expr(node->lhs);
+        return lower_expr(node->rhs);
+    case ND_CAST:
+        return lower_cast(lower_expr(node->lhs), node->lhs->ty, node->ty);
+    case ND_MEMZERO: {
+        Type *ty = node->var->ty;
+        if (node->zero_len) {
+            Ins *addr = new_binary(IR_ADD, 8, var_addr(node->var), new_imm(node->zero_offset));
+            new_unary(IR_MEMZERO, node->zero_len, addr);
+            return NULL;
+        }
+        if (is_integer(ty) || ty->kind == TY_PTR)
+            new_binary(IR_STORE, ty->size, var_addr(node->var), new_imm(0));
+        else
+            new_unary(IR_MEMZERO, ty->size, var_addr(node->var));
+        return NULL;
+    }
+    case ND_COND: {
+        BB *then = new_bb();
+        BB *els = new_bb();
+        BB *end = new_bb();
+        Obj *tmp = (node->ty->kind == TY_VOID) ? NULL : new_temp();
+
+        branch(lower_expr(node->cond), then, els);
+
+        start_bb(then);
+        Ins *val = lower_expr(node->then);
+        if (tmp)
+            lower_store(ty_long, var_addr(tmp), val);
+        jump(end);
+
+        start_bb(els);
+        val = lower_expr(node->els);
+        if (tmp)
+            lower_store(ty_long, var_addr(tmp), val);
+
+        start_bb(end);
+        return tmp ? lower_load(ty_long, var_addr(tmp)) : new_imm(0);
+    }
+    case ND_NOT:
+        return new_binary(IR_EQ, 8, lower_expr(node->lhs), new_imm(0));
+    case ND_BITNOT:
+        return new_unary(IR_NOT, 8, lower_expr(node->lhs));
+    case ND_LOGAND:
+    case ND_LOGOR:
+        return lower_logical(node);
+    case ND_FUNCALL: {
+        Ins *args[6];
+        int nargs = 0;
+        for (Node *arg = node->args; arg; arg = arg->next)
+            args[nargs++] = lower_expr(arg);
+
+        Type *ty = node->ty;
+        Ins *ins = new_ins(IR_CALL, is_integer(ty) ? ty->size : 8);
+        ins->funcname = node->funcname;
+        for (int i = 0; i < nargs; i++)
+            add_op(ins, args[i]);
+        return ins;
+    }
+    }
+
+    /*  like codegen, evaluate the right operand first. */
+    Ins *rhs = lower_expr(node->rhs);
+    Ins *lhs = lower_expr(node->lhs);
+    int size = op_size(node->lhs->ty);
+
+    switch (node->kind) {
+    case ND_ADD:    return new_binary(IR_ADD, size, lhs, rhs);
+    case ND_SUB:    return new_binary(IR_SUB, size, lhs, rhs);
+    case ND_MUL:    return new_binary(IR_MUL, size, lhs, rhs);
+    case ND_DIV:    return new_binary(IR_DIV, size, lhs, rhs);
+    case ND_MOD:    return new_binary(IR_MOD, size, lhs, rhs);
+    case ND_BITAND: return new_binary(IR_AND, 8, lhs, rhs);
+    case ND_BITOR:  return new_binary(IR_OR, 8, lhs, rhs);
+    case ND_BITXOR: return new_binary(IR_XOR, 8, lhs, rhs);
+    case ND_SHL:    return new_binary(IR_SHL, size, lhs, rhs);
+    case ND_SHR:    return new_binary(IR_SHR, size, lhs, rhs);
+    case ND_EQ:     return new_binary(IR_EQ, 8, lhs, rhs);
+    case ND_NE:     return new_binary(IR_NE, 8, lhs, rhs);
+    case ND_LT:     return new_binary(IR_LT, 8, lhs, rhs);
+    case ND_LE:     return new_binary(IR_LE, 8, lhs, rhs);
+    }
+    error_tok(node->tok, "invalid expression");
+}
+
+/*  lower a statement. returns the value of an expression statement.   */
+static int cmp_case(const void *a, const void *b) {
+    int64_t x = (*(Node **)a)->val;
+    int64_t y = (*(Node **)b)->val;
+    return (x > y) - (x < y);
+}
+
+/*  branch on 'cond' to one of cases[lo..hi), sorted by value, by
+    binary search over the values.  */
+static void lower_case_dispatch(Ins *cond, Node **cases, int lo, int hi, BB *dflt) {
+    if (hi - lo < 4) {
+        for (int i = lo; i < hi; i++) {
+            BB *next = new_bb();
+            branch(new_binary(IR_EQ, 8, cond, new_imm(cases[i]->val)), label_bb(cases[i]->label), next);
+            start_bb(next);
+        }
+        jump(dflt);
+        return;
+    }
+
+    int mid = lo + (hi - lo) / 2;
+    BB *ne = new_bb();
+    BB *left = new_bb();
+    BB *right = new_bb();
+
+    branch(new_binary(IR_EQ, 8, cond, new_imm(cases[mid]->val)), label_bb(cases[mid]->label), ne);
+    start_bb(ne);
+    branch(new_binary(IR_LT, 8, cond, new_imm(cases[mid]->val)), left, right);
+    start_bb(left);
+    lower_case_dispatch(cond, cases, lo, mid, dflt);
+    start_bb(right);
+    lower_case_dispatch(cond, cases, mid + 1, hi, dflt);
+}
+
+static Ins *lower_stmt(Node *node) {
+    switch (node->kind) {
+    case ND_IF: {
+        BB *then = new_bb();
+        BB *els = new_bb();
+        BB *end = new_bb();
+
+        branch(lower_expr(node->cond), then, els);
+        start_bb(then);
+        lower_stmt(node->then);
+        jump(end);
+        start_bb(els);
+        if (node->els)
+            lower_stmt(node->els);
+        start_bb(end);
+        return NULL;
+    }
+    case ND_FOR: {
+        BB *begin = new_bb();
+        BB *brk = label_bb(node->brk_label);
+
+        if (node->init)
+            lower_stmt(node->init);
+        start_bb(begin);
+        if (node->cond) {
+            BB *body = new_bb();
+            branch(lower_expr(node->cond), body, brk);
+            start_bb(body);
+        }
+        lower_stmt(node->then);
+        start_bb(label_bb(node->cont_label));
+        if (node->inc)
+            lower_expr(node->inc);
+        jump(begin);
+        start_bb(brk);
+        return NULL;
+    }
+    case ND_SWITCH: {
+        Ins *cond = lower_expr(node->cond);
+
+        int ncases = 0;
+        for (Node *n = node->case_next; n; n = n->case_next)
+            ncases++;
+
+        Node **cases = calloc(ncases, sizeof(Node *));
+        ncases = 0;
+        for (Node *n = node->case_next; n; n = n->case_next)
+            cases[ncases++] = n;
+        qsort(cases, ncases, sizeof(Node *), cmp_case);
+
+        char *dflt = node->default_case ? node->default_case->label : node->brk_label;
+        lower_case_dispatch(cond, cases, 0, ncases, label_bb(dflt));
+        free(cases);
+
+        start_bb(new_bb());
+        lower_stmt(node->then);
+        start_bb(label_bb(node->brk_label));
+        return NULL;
+    }
+    case ND_CASE:
+        start_bb(label_bb(node->label));
+        lower_stmt(node->lhs);
+        return NULL;
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+            lower_stmt(n);
+        return NULL;
+    case ND_GOTO:
+        jump(label_bb(node->unique_label));
+        start_bb(new_bb());
+        return NULL;
+    case ND_LABEL:
+        start_bb(label_bb(node->unique_label));
+        lower_stmt(node->lhs);
+        return NULL;
+    case ND_RETURN:
+        new_unary(IR_RET, 8, lower_expr(node->lhs));
+        start_bb(new_bb());
+        return NULL;
+    case ND_EXPR_STMT:
+        return lower_expr(node->lhs);
+    }
+    error_tok(node->tok, "invalid statement");
+}
+
+static void mark_reachable(BB *bb, bool *reachable) {
+    if (reachable[bb->id])
+        return;
+    reachable[bb->id] = true;
+
+    BB *succs[2];
+    int n = get_succs(bb, succs);
+    for (int i = 0; i < n; i++)
+        mark_reachable(succs[i], reachable);
+}
+
+void compute_preds(IRFunc *f) {
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        free(bb->preds);
+        bb->preds = NULL;
+        bb->npreds = 0;
+    }
+
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        BB *succs[2];
+        int n = get_succs(bb, succs);
+        for (int i = 0; i < n; i++) {
+            BB *s = succs[i];
+            s->preds = realloc(s->preds, sizeof(BB *) * (s->npreds + 1));
+            s->preds[s->npreds++] = bb;
+        }
+    }
+}
+
+/*  drop the blocks that follow a return or a goto and are never entered.  */
+static void remove_unreachable(IRFunc *f) {
+    int max_id = 0;
+    for (BB *bb = f->bbs; bb; bb = bb->next)
+        max_id = MAX(max_id, bb->id);
+    for (LabelBB *l = label_bbs; l; l = l->next)
+        max_id = MAX(max_id, l->bb->id);
+
+    bool *reachable = calloc(max_id + 1, sizeof(bool));
+    mark_reachable(f->bbs, reachable);
+
+    BB **p = &f->bbs;
+    while (*p) {
+        if (reachable[(*p)->id])
+            p = &(*p)->next;
+        else
+            *p = (*p)->next;
+    }
+    free(reachable);
+    compute_preds(f);
+}
+
+IRFunc *lower_function(Obj *fn) {
+    IRFunc *f = calloc(1, sizeof(IRFunc));
+    f->fn = fn;
+    cur_fn = f;
+    label_bbs = NULL;
+    f->bbs = bb_tail = cur_bb = new_bb();
+
+    int i = 0;
+    for (Obj *var = fn->params; var; var = var->next) {
+        Ins *param = new_ins(IR_PARAM, var->ty->size);
+        param->val = i++;
+        lower_store(var->ty, var_addr(var), param);
+    }
+
+    lower_stmt(fn->body);
+    if (!is_terminator(cur_bb->last))
+        new_ins(IR_RET, 8);
+
+    remove_unreachable(f);
+    return f;
+}
+
+/*
+ *  dominators
+ */
+
+static BB **rpo;
+static int nbbs;
+
+static void postorder(BB *bb, bool *visited, BB **order, int *n) {
+    visited[bb->rpo] = true;
+
+    BB *succs[2];
+    int nsuccs = get_succs(bb, succs);
+    for (int i = 0; i < nsuccs; i++)
+        if (!visited[succs[i]->rpo])
+            postorder(succs[i], visited, order, n);
+    order[(*n)++] = bb;
+}
+
+static BB *intersect(BB *a, BB *b) {
+    while (a != b) {
+        while (a->rpo > b->rpo)
+            a = a->idom;
+        while (b->rpo > a->rpo)
+            b = b->idom;
+    }
+    return a;
+}
+
+static void add_df(BB *bb, BB *y) {
+    for (int i = 0; i < bb->ndf; i++)
+        if (bb->df[i] == y)
+            return;
+    bb->df = realloc(bb->df, sizeof(BB *) * (bb->ndf + 1));
+    bb->df[bb->ndf++] = y;
+}
+
+/*  the iterative algorithm of Cooper, Harvey and Kennedy.  */
+static void compute_dominators(IRFunc *f) {
+    nbbs = 0;
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        bb->rpo = nbbs++;
+        bb->idom = NULL;
+        bb->ndf = 0;
+    }
+
+    bool *visited = calloc(nbbs, sizeof(bool));
+    BB **order = calloc(nbbs, sizeof(BB *));
+    int n = 0;
+    postorder(f->bbs, visited, order, &n);
+    free(visited);
+
+    rpo = calloc(n, sizeof(BB *));
+    for (int i = 0; i < n; i++) {
+        rpo[i] = order[n - 1 - i];
+        rpo[i]->rpo = i;
+    }
+    free(order);
+
+    BB *entry = rpo[0];
+    entry->idom = entry;
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 1; i < n; i++) {
+            BB *bb = rpo[i];
+            BB *idom = NULL;
+            for (int j = 0; j < bb->npreds; j++) {
+                BB *p = bb->preds[j];
+                if (!p->idom)
+                    continue;
+                idom = idom ? intersect(p, idom) : p;
+            }
+            if (bb->idom != idom) {
+                bb->idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        BB *bb = rpo[i];
+        if (bb->npreds < 2)
+            continue;
+        for (int j = 0; j < bb->npreds; j++)
+            for (BB *r = bb->preds[j]; r != bb->idom; r = r->idom)
+                add_df(r, bb);
+    }
+}
+
+/*
+ *  mem2reg
+ */
+
+static Obj **pvars;     /* promoted locals  */
+static int npvars;
+static Ins *undef;
+
+static int pvar_index(Ins *addr) {
+    if (addr->kind != IR_LADDR)
+        return -1;
+    for (int i = 0; i < npvars; i++)
+        if (pvars[i] == addr->var)
+            return i;
+    return -1;
+}
+
+static Ins *resolve(Ins *ins) {
+    while (ins && ins->fwd)
+        ins = ins->fwd;
+    return ins;
+}
+
+/*  a local can be promoted if it is a scalar whose address is only
+    ever used to load or store it in its own width.     */
+static void find_promotable(IRFunc *f) {
+    npvars = 0;
+    for (Obj *var = f->fn->locals; var; var = var->next)
+        npvars++;
+    pvars = calloc(npvars, sizeof(Obj *));
+    npvars = 0;
+    for (Obj *var = f->fn->locals; var; var = var->next)
+        if (is_integer(var->ty) || var->ty->kind == TY_PTR)
+            pvars[npvars++] = var;
+
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        for (Ins *ins = bb->ins; ins; ins = ins->next) {
+            for (int i = 0; i < ins->nops; i++) {
+                int idx = pvar_index(ins->ops[i]);
+                if (idx < 0)
+                    continue;
+                bool ok = i == 0 && (ins->kind == IR_LOAD || ins->kind == IR_STORE) &&
+                          ins->size == pvars[idx]->ty->size;
+                if (!ok)
+                    pvars[idx] = pvars[--npvars];
+            }
+        }
+    }
+}
+
+static Ins *new_phi(BB *bb, Obj *var) {
+    Ins *phi = calloc(1, sizeof(Ins));
+    phi->kind = IR_PHI;
+    phi->size = var->ty->size;
+    phi->id = cur_fn->nvals++;
+    phi->bb = bb;
+    phi->var = var;
+    phi->next = bb->ins;
+    bb->ins = phi;
+    return phi;
+}
+
+static void insert_phis(IRFunc *f) {
+    bool *has_phi = calloc(nbbs, sizeof(bool));
+    bool *queued = calloc(nbbs, sizeof(bool));
+    BB **work = calloc(nbbs, sizeof(BB *));
+
+    for (int v = 0; v < npvars; v++) {
+        memset(has_phi, 0, nbbs * sizeof(bool));
+        memset(queued, 0, nbbs * sizeof(bool));
+        int n = 0;
+
+        for (BB *bb = f->bbs; bb; bb = bb->next) {
+            for (Ins *ins = bb->ins; ins; ins = ins->next) {
+                if (ins->kind == IR_STORE && pvar_index(ins->ops[0]) == v) {
+                    if (!queued[bb->rpo]) {
+                        queued[bb->rpo] = true;
+                        work[n++] = bb;
+                    }
+                    break;
+                }
+            }
+        }
+
+        while (n > 0) {
+            BB *x = work[--n];
+            for (int i = 0; i < x->ndf; i++) {
+                BB *y = x->df[i];
+                if (has_phi[y->rpo])
+                    continue;
+                new_phi(y, pvars[v]);
+                has_phi[y->rpo] = true;
+                if (!queued[y->rpo]) {
+                    queued[y->rpo] = true;
+                    work[n++] = y;
+                }
+            }
+        }
+    }
+    free(has_phi);
+    free(queued);
+    free(work);
+}
+
+static Ins *current_def(Ins **defs, int v) {
+    return defs[v] ? defs[v] : undef;
+}
+
+static void add_phi_op(Ins *phi, BB *bb, Ins *val) {
+    phi->phi_bbs = realloc(phi->phi_bbs, sizeof(BB *) * (phi->nops + 1));
+    phi->phi_bbs[phi->nops] = bb;
+    add_op(phi, val);
+}
+
+static void rename_vars(BB *bb, Ins **defs, BB ***children, int *nchildren) {
+    Ins **saved = calloc(npvars, sizeof(Ins *));
+    memcpy(saved, defs, npvars * sizeof(Ins *));
+
+    for (Ins *ins = bb->ins; ins; ins = ins->next) {
+        if (ins->kind == IR_PHI && ins->var) {
+            for (int v = 0; v < npvars; v++)
+                if (pvars[v] == ins->var)
+                    defs[v] = ins;
+            continue;
+        }
+        if (ins->kind != IR_LOAD && ins->kind != IR_STORE)
+            continue;
+
+        int v = pvar_index(ins->ops[0]);
+        if (v < 0)
+            continue;
+        if (ins->kind == IR_LOAD)
+            ins->fwd = current_def(defs, v);
+        else
+            defs[v] = resolve(ins->ops[1]);
+        ins->dead = true;
+        ins->ops[0]->dead = true;
+    }
+
+    BB *succs[2];
+    int n = get_succs(bb, succs);
+    for (int i = 0; i < n; i++) {
+        for (Ins *phi = succs[i]->ins; phi && phi->kind == IR_PHI; phi = phi->next) {
+            if (!phi->var)
+                continue;
+            for (int v = 0; v < npvars; v++)
+                if (pvars[v] == phi->var)
+                    add_phi_op(phi, bb, current_def(defs, v));
+        }
+    }
+
+    for (int i = 0; i < nchildren[bb->rpo]; i++)
+        rename_vars(children[bb->rpo][i], defs, children, nchildren);
+
+    memcpy(defs, saved, npvars * sizeof(Ins *));
+    free(saved);
+}
+
+static void resolve_ops(IRFunc *f) {
+    for (BB *bb = f->bbs; bb; bb = bb->next)
+        for (Ins *ins = bb->ins; ins; ins = ins->next)
+            for (int i = 0; i < ins->nops; i++)
+                ins->ops[i] = resolve(ins->ops[i]);
+}
+
+static void sweep(IRFunc *f) {
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        Ins head = {};
+        Ins *cur = &head;
+        for (Ins *ins = bb->ins; ins; ins = ins->next)
+            if (!ins->dead && !ins->fwd)
+                cur = cur->next = ins;
+        cur->next = NULL;
+        bb->ins = head.next;
+        bb->last = cur;
+    }
+}
+
+/*  a phi whose operands are all the same value, or the phi itself,
+    is just that value.  */
+static bool remove_trivial_phis(IRFunc *f) {
+    bool changed = false;
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        for (Ins *phi = bb->ins; phi && phi->kind == IR_PHI; phi = phi->next) {
+            if (phi->fwd)
+                continue;
+
+            Ins *same = NULL;
+            bool trivial = true;
+            for (int i = 0; i < phi->nops; i++) {
+                Ins *op = resolve(phi->ops[i]);
+                if (op == phi || op == same)
+                    continue;
+                if (same) {
+                    trivial = false;
+                    break;
+                }
+                same = op;
+            }
+            if (trivial && same) {
+                phi->fwd = same;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+static bool has_side_effect(Ins *ins) {
+    switch (ins->kind) {
+    case IR_STORE:
+    case IR_MEMCPY:
+    case IR_MEMZERO:
+    case IR_CALL:
+    case IR_JMP:
+    case IR_BR:
+    case IR_RET:
+        return true;
+    }
+    return false;
+}
+
+static void mark_live(Ins *ins) {
+    if (!ins->dead)
+        return;
+    ins->dead = false;
+    for (int i = 0; i < ins->nops; i++)
+        mark_live(ins->ops[i]);
+}
+
+/*  remove instructions whose values are never used.    */
+static void eliminate_dead_code(IRFunc *f) {
+    for (BB *bb = f->bbs; bb; bb = bb->next)
+        for (Ins *ins = bb->ins; ins; ins = ins->next)
+            ins->dead = true;
+    for (BB *bb = f->bbs; bb; bb = bb->next)
+        for (Ins *ins = bb->ins; ins; ins = ins->next)
+            if (has_side_effect(ins))
+                mark_live(ins);
+    sweep(f);
+}
+
+void mem2reg(IRFunc *f) {
+    cur_fn = f;
+    compute_dominators(f);
+    find_promotable(f);
+
+    if (npvars > 0) {
+        /*  reading a promoted local before any store yields zero.  */
+        undef = calloc(1, sizeof(Ins));
+        undef->kind = IR_IMM;
+        undef->size = 8;
+        undef->id = f->nvals++;
+        undef->bb = f->bbs;
+        undef->next = f->bbs->ins;
+        f->bbs->ins = undef;
+
+        insert_phis(f);
+
+        BB ***children = calloc(nbbs, sizeof(BB **));
+        int *nchildren = calloc(nbbs, sizeof(int));
+        for (int i = 1; i < nbbs; i++) {
+            BB *p = rpo[i]->idom;
+            children[p->rpo] = realloc(children[p->rpo], sizeof(BB *) * (nchildren[p->rpo] + 1));
+            children[p->rpo][nchildren[p->rpo]++] = rpo[i];
+        }
+
+        Ins **defs = calloc(npvars, sizeof(Ins *));
+        rename_vars(f->bbs, defs, children, nchildren);
+        free(defs);
+        free(children);
+        free(nchildren);
+
+        while (remove_trivial_phis(f))
+            ;
+        resolve_ops(f);
+        sweep(f);
+    }
+
+    eliminate_dead_code(f);
+    free(pvars);
+    free(rpo);
+}
+
+/*
+ *  IR dump
+ */
+
+static char *ir_name[] = {
+    [IR_IMM] = "imm", [IR_PARAM] = "param", [IR_LADDR] = "laddr",
+    [IR_GADDR] = "gaddr", [IR_ADD] = "add", [IR_SUB] = "sub", [IR_MUL] = "mul",
+    [IR_DIV] = "div", [IR_MOD] = "mod", [IR_AND] = "and", [IR_OR] = "or",
+    [IR_XOR] = "xor", [IR_SHL] = "shl", [IR_SHR] = "shr", [IR_EQ] = "eq",
+    [IR_NE] = "ne", [IR_LT] = "lt", [IR_LE] = "le", [IR_NEG] = "neg",
+    [IR_NOT] = "not", [IR_SEXT] = "sext", [IR_LOAD] = "load",
+    [IR_STORE] = "store", [IR_MEMCPY] = "memcpy", [IR_MEMZERO] = "memzero",
+    [IR_CALL] = "call", [IR_PHI] = "phi", [IR_JMP] = "jmp", [IR_BR] = "br",
+    [IR_RET] = "ret",
+};
+
+void dump_ir(IRFunc *f, FILE *out) {
+    fprintf(out, "function %s\n", f->fn->name);
+
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        fprintf(out, "bb%d:", bb->id);
+        for (int i = 0; i < bb->npreds; i++)
+            fprintf(out, "%s bb%d", i ? "," : "\t\t; preds", bb->preds[i]->id);
+        fprintf(out, "\n");
+
+        for (Ins *ins = bb->ins; ins; ins = ins->next) {
+            fprintf(out, "\t");
+            if (!has_side_effect(ins) || ins->kind == IR_CALL)
+                fprintf(out, "v%d = ", ins->id);
+            fprintf(out, "%s.%d", ir_name[ins->kind], ins->size);
+
+            if (ins->kind == IR_IMM || ins->kind == IR_PARAM)
+                fprintf(out, " %ld", ins->val);
+            if (ins->var)
+                fprintf(out, " %s", *ins->var->name ? ins->var->name : "<tmp>");
+            if (ins->funcname)
+                fprintf(out, " %s", ins->funcname);
+            for (int i = 0; i < ins->nops; i++) {
+                fprintf(out, "%s v%d", i ? "," : "", ins->ops[i]->id);
+                if (ins->kind == IR_PHI)
+                    fprintf(out, " [bb%d]", ins->phi_bbs[i]->id);
+            }
+            if (ins->then)
+                fprintf(out, "%s bb%d", ins->nops ? "," : "", ins->then->id);
+            if (ins->els)
+                fprintf(out, ", bb%d", ins->els->id);
+            fprintf(out, "\n");
+        }
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,684 @@
+#include "c.h"
+
+/*  x86-64 code generation from the SSA IR.
+
+    critical edges are split first so that phi operands can be copied at
+    the end of their predecessor.  values then get live intervals from a
+    backward liveness analysis over the blocks in layout order and are
+    assigned registers by linear scan.  calls clobber the caller-saved
+    registers, so an interval spanning a call only gets a callee-saved
+    one.  whatever does not fit goes to an 8-byte stack slot.  constants
+    and addresses of variables are rematerialized at each use.          */
+
+static char *argreg8[] = {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"};
+static char *argreg16[] = {"%di", "%si", "%dx", "%cx", "%r8w", "%r9w"};
+static char *argreg32[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
+static char *argreg64[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+
+/*  the callee-saved registers come first.  */
+static char *reg64[] = {"%rbx", "%r12", "%r13", "%r14", "%r15", "%r10", "%r11"};
+#define NUM_REGS (sizeof(reg64) / sizeof(*reg64))
+#define NUM_CALLEE_SAVED 5
+
+static IRFunc *cur_fn;
+static int *ins_pos;
+static int *start;
+static int *end;
+static int *call_pos;
+static int ncalls;
+static int frame_size;
+static int used_regs;
+
+/*
+ *  critical edges
+ */
+
+/*  a branch to a block with phis that has other predecessors gets a
+    block of its own on that edge to hold the phi copies.   */
+static void split_critical_edges(IRFunc *f) {
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        Ins *br = bb->last;
+        if (br->kind != IR_BR)
+            continue;
+
+        for (int i = 0; i < 2; i++) {
+            BB **target = i ? &br->els : &br->then;
+            BB *succ = *target;
+            if (succ->npreds < 2 || succ->ins->kind != IR_PHI)
+                continue;
+
+            BB *mid = new_bb();
+            Ins *jmp = calloc(1, sizeof(Ins));
+            jmp->kind = IR_JMP;
+            jmp->id = f->nvals++;
+            jmp->bb = mid;
+            jmp->then = succ;
+            mid->ins = mid->last = jmp;
+
+            mid->next = bb->next;
+            bb->next = mid;
+            *target = mid;
+
+            for (Ins *phi = succ->ins; phi && phi->kind == IR_PHI; phi = phi->next)
+                for (int j = 0; j < phi->nops; j++)
+                    if (phi->phi_bbs[j] == bb)
+                        phi->phi_bbs[j] = mid;
+        }
+    }
+    compute_preds(f);
+}
+
+/*
+ *  liveness and register allocation
+ */
+
+static bool is_remat(Ins *ins) {
+    return ins->kind == IR_IMM || ins->kind == IR_LADDR || ins->kind == IR_GADDR;
+}
+
+static bool has_value(Ins *ins) {
+    switch (ins->kind) {
+    case IR_STORE:
+    case IR_MEMCPY:
+    case IR_MEMZERO:
+    case IR_JMP:
+    case IR_BR:
+    case IR_RET:
+        return false;
+    }
+    return !is_remat(ins);
+}
+
+typedef uint64_t *Bits;
+
+static int nwords;
+
+static Bits new_bits(void) {
+    return calloc(nwords, sizeof(uint64_t));
+}
+
+static void set_bit(Bits b, int i) {
+    b[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static bool get_bit(Bits b, int i) {
+    return b[i / 64] >> (i % 64) & 1;
+}
+
+static void extend(int id, int pos) {
+    start[id] = MIN(start[id], pos);
+    end[id] = MAX(end[id], pos);
+}
+
+static void extend_bits(Bits b, int pos) {
+    for (int w = 0; w < nwords; w++)
+        for (uint64_t x = b[w]; x; x &= x - 1)
+            extend(w * 64 + __builtin_ctzll(x), pos);
+}
+
+/*  an instruction at position p reads its operands at p and writes its
+    result at p + 1, so an operand may die into the result's register.  */
+static void compute_intervals(IRFunc *f) {
+    int nbbs = 0;
+    for (BB *bb = f->bbs; bb; bb = bb->next)
+        nbbs++;
+
+    BB **bbs = calloc(nbbs, sizeof(BB *));
+    nbbs = 0;
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        bb->rpo = nbbs;
+        bbs[nbbs++] = bb;
+    }
+
+    nwords = (f->nvals + 63) / 64;
+    Bits *use = calloc(nbbs, sizeof(Bits));
+    Bits *def = calloc(nbbs, sizeof(Bits));
+    Bits *live_in = calloc(nbbs, sizeof(Bits));
+    Bits *live_out = calloc(nbbs, sizeof(Bits));
+    int *bb_start = calloc(nbbs, sizeof(int));
+    int *bb_end = calloc(nbbs, sizeof(int));
+
+    ins_pos = calloc(f->nvals, sizeof(int));
+    call_pos = calloc(f->nvals, sizeof(int));
+    ncalls = 0;
+    int pos = 0;
+
+    for (int b = 0; b < nbbs; b++) {
+        use[b] = new_bits();
+        def[b] = new_bits();
+        live_in[b] = new_bits();
+        live_out[b] = new_bits();
+        bb_start[b] = pos++;
+
+        for (Ins *ins = bbs[b]->ins; ins; ins = ins->next) {
+            ins_pos[ins->id] = pos;
+            if (ins->kind == IR_CALL)
+                call_pos[ncalls++] = pos;
+            pos += 2;
+
+            if (ins->kind != IR_PHI)
+                for (int i = 0; i < ins->nops; i++)
+                    if (!is_remat(ins->ops[i]) && !get_bit(def[b], ins->ops[i]->id))
+                        set_bit(use[b], ins->ops[i]->id);
+            if (has_value(ins))
+                set_bit(def[b], ins->id);
+        }
+        bb_end[b] = pos++;
+    }
+
+    /*  phi operands are live out of the predecessor they come from.  */
+    for (int b = 0; b < nbbs; b++)
+        for (Ins *phi = bbs[b]->ins; phi && phi->kind == IR_PHI; phi = phi->next)
+            for (int i = 0; i < phi->nops; i++)
+                if (!is_remat(phi->ops[i]))
+                    set_bit(live_out[phi->phi_bbs[i]->rpo], phi->ops[i]->id);
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int b = nbbs - 1; b >= 0; b--) {
+            BB *succs[2];
+            int n = get_succs(bbs[b], succs);
+            for (int i = 0; i < n; i++)
+                for (int w = 0; w < nwords; w++)
+                    live_out[b][w] |= live_in[succs[i]->rpo][w];
+
+            for (int w = 0; w < nwords; w++) {
+                uint64_t in = use[b][w] | (live_out[b][w] & ~def[b][w]);
+                if (in != live_in[b][w]) {
+                    live_in[b][w] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    start = calloc(f->nvals, sizeof(int));
+    end = calloc(f->nvals, sizeof(int));
+    for (int i = 0; i < f->nvals; i++) {
+        start[i] = INT32_MAX;
+        end[i] = -1;
+    }
+
+    for (int b = 0; b < nbbs; b++) {
+        extend_bits(live_in[b], bb_start[b]);
+        extend_bits(live_out[b], bb_end[b]);
+
+        for (Ins *ins = bbs[b]->ins; ins; ins = ins->next) {
+            int p = ins_pos[ins->id];
+
+            /*  a phi is written by the copies at the end of each predecessor. */
+            if (ins->kind == IR_PHI) {
+                for (int i = 0; i < ins->nops; i++)
+                    extend(ins->id, bb_end[ins->phi_bbs[i]->rpo]);
+                extend(ins->id, p);
+                continue;
+            }
+
+            if (has_value(ins))
+                extend(ins->id, p + 1);
+            for (int i = 0; i < ins->nops; i++)
+                if (!is_remat(ins->ops[i]))
+                    extend(ins->ops[i]->id, p);
+        }
+    }
+
+    for (int b = 0; b < nbbs; b++) {
+        free(use[b]);
+        free(def[b]);
+        free(live_in[b]);
+        free(live_out[b]);
+    }
+    free(use);
+    free(def);
+    free(live_in);
+    free(live_out);
+    free(bb_start);
+    free(bb_end);
+    free(bbs);
+}
+
+/*  a value live both before and after a call must survive it. */
+static bool crosses_call(Ins *ins) {
+    for (int i = 0; i < ncalls; i++)
+        if (start[ins->id] <= call_pos[i] && call_pos[i] < end[ins->id])
+            return true;
+    return false;
+}
+
+static int cmp_start(const void *a, const void *b) {
+    return start[(*(Ins **)a)->id] - start[(*(Ins **)b)->id];
+}
+
+static void spill(Ins *ins) {
+    ins->reg = 0;
+    frame_size += 8;
+    ins->offset = -frame_size;
+}
+
+static void linear_scan(IRFunc *f) {
+    Ins **ivs = calloc(f->nvals, sizeof(Ins *));
+    int n = 0;
+
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        for (Ins *ins = bb->ins; ins; ins = ins->next) {
+            ins->reg = 0;
+            ins->offset = 0;
+            /*  a value that is never used needs no location.   */
+            if (has_value(ins) && start[ins->id] < end[ins->id])
+                ivs[n++] = ins;
+        }
+    }
+    qsort(ivs, n, sizeof(Ins *), cmp_start);
+
+    Ins *active[NUM_REGS] = {};
+
+    for (int i = 0; i < n; i++) {
+        Ins *iv = ivs[i];
+        for (int r = 0; r < NUM_REGS; r++)
+            if (active[r] && end[active[r]->id] < start[iv->id])
+                active[r] = NULL;
+
+        int nregs = crosses_call(iv) ? NUM_CALLEE_SAVED : NUM_REGS;
+
+        /*  prefer a caller-saved register, which costs no save.    */
+        int r = -1;
+        for (int j = nregs - 1; j >= 0; j--) {
+            if (!active[j]) {
+                r = j;
+                break;
+            }
+        }
+
+        if (r < 0) {
+            r = 0;
+            for (int j = 1; j < nregs; j++)
+                if (end[active[r]->id] < end[active[j]->id])
+                    r = j;
+            if (end[active[r]->id] <= end[iv->id]) {
+                spill(iv);
+                continue;
+            }
+            spill(active[r]);
+        }
+
+        active[r] = iv;
+        iv->reg = r + 1;
+        used_regs |= 1 << r;
+    }
+    free(ivs);
+}
+
+/*
+ *  code emission
+ */
+
+static void fetch(Ins *ins, char *reg) {
+    switch (ins->kind) {
+    case IR_IMM:
+        println("\tmov\t$%ld, %s", ins->val, reg);
+        return;
+    case IR_LADDR:
+        println("\tlea\t%d(%%rbp), %s", ins->var->offset, reg);
+        return;
+    case IR_GADDR:
+        println("\tlea\t%s(%%rip), %s", ins->var->name, reg);
+        return;
+    }
+
+    if (ins->reg)
+        println("\tmov\t%s, %s", reg64[ins->reg - 1], reg);
+    else
+        println("\tmov\t%d(%%rbp), %s", ins->offset, reg);
+}
+
+/*  store %rax to the location of a value.  */
+static void put(Ins *ins) {
+    if (ins->reg)
+        println("\tmov\t%%rax, %s", reg64[ins->reg - 1]);
+    else if (ins->offset)
+        println("\tmov\t%%rax, %d(%%rbp)", ins->offset);
+}
+
+static bool has_loc(Ins *ins) {
+    return ins->reg || ins->offset;
+}
+
+static void sext(int size) {
+    if (size == 1)
+        println("\tmovsbq\t%%al, %%rax");
+    else if (size == 2)
+        println("\tmovswq\t%%ax, %%rax");
+    else if (size == 4)
+        println("\tmovslq\t%%eax, %%rax");
+}
+
+static void load(int size) {
+    if (size == 1)
+        println("\tmovsbq\t(%%rax), %%rax");
+    else if (size == 2)
+        println("\tmovswq\t(%%rax), %%rax");
+    else if (size == 4)
+        println("\tmovslq\t(%%rax), %%rax");
+    else
+        println("\tmov\t(%%rax), %%rax");
+}
+
+static bool same_loc(Ins *a, Ins *b) {
+    if (is_remat(a) || is_remat(b))
+        return false;
+    if (a->reg || b->reg)
+        return a->reg == b->reg;
+    return a->offset == b->offset;
+}
+
+static void move(Ins *src, Ins *dst) {
+    if (same_loc(src, dst))
+        return;
+    if (dst->reg) {
+        fetch(src, reg64[dst->reg - 1]);
+        return;
+    }
+    fetch(src, "%rax");
+    put(dst);
+}
+
+/*  copy the operands of the phis in 'succ' that flow in from 'bb'.
+    the copies happen in parallel: a copy is emitted once no other
+    pending copy still reads its destination, and whatever is left
+    forms cycles that go through the stack.     */
+static void copy_phis(BB *bb, BB *succ) {
+    int n = 0;
+    for (Ins *phi = succ->ins; phi && phi->kind == IR_PHI; phi = phi->next)
+        n++;
+
+    Ins **dst = calloc(n, sizeof(Ins *));
+    Ins **src = calloc(n, sizeof(Ins *));
+    n = 0;
+    for (Ins *phi = succ->ins; phi && phi->kind == IR_PHI; phi = phi->next) {
+        if (!has_loc(phi))
+            continue;
+        for (int i = 0; i < phi->nops; i++) {
+            if (phi->phi_bbs[i] == bb && !same_loc(phi->ops[i], phi)) {
+                dst[n] = phi;
+                src[n++] = phi->ops[i];
+            }
+        }
+    }
+
+    for (bool progress = true; progress;) {
+        progress = false;
+        for (int i = 0; i < n; i++) {
+            bool blocked = false;
+            for (int j = 0; j < n; j++)
+                if (j != i && same_loc(src[j], dst[i]))
+                    blocked = true;
+            if (blocked)
+                continue;
+
+            move(src[i], dst[i]);
+            src[i] = src[n - 1];
+            dst[i] = dst[n - 1];
+            n--;
+            i--;
+            progress = true;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        fetch(src[i], "%rax");
+        println("\tpush\t%%rax");
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        println("\tpop\t%%rax");
+        put(dst[i]);
+    }
+    free(dst);
+    free(src);
+}
+
+static void gen_binary(Ins *ins) {
+    Ins *imm = ins->ops[1]->kind == IR_IMM ? ins->ops[1] : NULL;
+    bool is_mod = ins->kind == IR_MOD;
+
+    if (opt_level && imm && (ins->kind == IR_MUL ||
+                (ins->kind == IR_DIV || is_mod) && is_div_imm(imm->val, ins->size, is_mod))) {
+        fetch(ins->ops[0], "%rax");
+        if (ins->kind == IR_MUL)
+            gen_mul_imm(imm->val, ins->size);
+        else
+            gen_div_imm(imm->val, ins->size, is_mod);
+        sext(ins->size);
+        put(ins);
+        return;
+    }
+
+    fetch(ins->ops[1], "%rdi");
+    fetch(ins->ops[0], "%rax");
+
+    char *ax = (ins->size == 8) ? "%rax" : "%eax";
+    char *di = (ins->size == 8) ? "%rdi" : "%edi";
+
+    switch (ins->kind) {
+    case IR_ADD:
+        println("\tadd\t%s, %s", di, ax);
+        break;
+    case IR_SUB:
+        println("\tsub\t%s, %s", di, ax);
+        break;
+    case IR_MUL:
+        println("\timul\t%s, %s", di, ax);
+        break;
+    case IR_DIV:
+    case IR_MOD:
+        println(ins->size == 8 ? "\tcqo" : "\tcdq");
+        println("\tidiv\t%s", di);
+        if (ins->kind == IR_MOD)
+            println("\tmov\t%%rdx, %%rax");
+        break;
+    case IR_AND:
+        println("\tand\t%%rdi, %%rax");
+        break;
+    case IR_OR:
+        println("\tor\t%%rdi, %%rax");
+        break;
+    case IR_XOR:
+        println("\txor\t%%rdi, %%rax");
+        break;
+    case IR_SHL:
+        println("\tmov\t%%rdi, %%rcx");
+        println("\tshl\t%%cl, %s", ax);
+        break;
+    case IR_SHR:
+        println("\tmov\t%%rdi, %%rcx");
+        println("\tsar\t%%cl, %s", ax);
+        break;
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+        println("\tcmp\t%%rdi, %%rax");
+        if (ins->kind == IR_EQ)
+            println("\tsete\t%%al");
+        else if (ins->kind == IR_NE)
+            println("\tsetne\t%%al");
+        else if (ins->kind == IR_LT)
+            println("\tsetl\t%%al");
+        else
+            println("\tsetle\t%%al");
+        println("\tmovzb\t%%al, %%rax");
+        put(ins);
+        return;
+    default:
+        unreachable();
+    }
+
+    sext(ins->size);
+    put(ins);
+}
+
+static void gen_ins(Ins *ins) {
+    switch (ins->kind) {
+    case IR_IMM:
+    case IR_LADDR:
+    case IR_GADDR:
+    case IR_PHI:
+        return;
+    case IR_PARAM: {
+        int i = ins->val;
+        if (ins->size == 1)
+            println("\tmovsbq\t%s, %%rax", argreg8[i]);
+        else if (ins->size == 2)
+            println("\tmovswq\t%s, %%rax", argreg16[i]);
+        else if (ins->size == 4)
+            println("\tmovslq\t%s, %%rax", argreg32[i]);
+        else
+            println("\tmov\t%s, %%rax", argreg64[i]);
+        put(ins);
+        return;
+    }
+    case IR_NEG:
+        fetch(ins->ops[0], "%rax");
+        println("\tneg\t%%rax");
+        sext(ins->size);
+        put(ins);
+        return;
+    case IR_NOT:
+        fetch(ins->ops[0], "%rax");
+        println("\tnot\t%%rax");
+        put(ins);
+        return;
+    case IR_SEXT:
+        fetch(ins->ops[0], "%rax");
+        sext(ins->size);
+        put(ins);
+        return;
+    case IR_LOAD:
+        fetch(ins->ops[0], "%rax");
+        load(ins->size);
+        put(ins);
+        return;
+    case IR_STORE:
+        fetch(ins->ops[0], "%rdi");
+        fetch(ins->ops[1], "%rax");
+        if (ins->size == 1)
+            println("\tmov\t%%al, (%%rdi)");
+        else if (ins->size == 2)
+            println("\tmov\t%%ax, (%%rdi)");
+        else if (ins->size == 4)
+            println("\tmov\t%%eax, (%%rdi)");
+        else
+            println("\tmov\t%%rax, (%%rdi)");
+        return;
+    case IR_MEMCPY:
+        fetch(ins->ops[0], "%rdi");
+        fetch(ins->ops[1], "%rax");
+        copy_mem("%rdi", "%rax", ins->size, 1);
+        return;
+    case IR_MEMZERO:
+        if (ins->ops[0]->kind == IR_LADDR) {
+            Obj *var = ins->ops[0]->var;
+            zero_mem("%rbp", var->offset, ins->size, var->ty->align);
+            return;
+        }
+        fetch(ins->ops[0], "%rdi");
+        zero_mem("%rdi", 0, ins->size, 1);
+        return;
+    case IR_CALL:
+        for (int i = 0; i < ins->nops; i++)
+            fetch(ins->ops[i], argreg64[i]);
+        println("\tmov\t$0, %%rax");
+        println("\tcall\t%s", ins->funcname);
+        sext(ins->size);
+        put(ins);
+        return;
+    case IR_JMP:
+        copy_phis(ins->bb, ins->then);
+        if (ins->bb->next != ins->then)
+            println("\tjmp\t.L.bb.%d", ins->then->id);
+        return;
+    case IR_BR:
+        fetch(ins->ops[0], "%rax");
+        println("\tcmp\t$0, %%rax");
+        if (ins->bb->next == ins->els) {
+            println("\tjne\t.L.bb.%d", ins->then->id);
+            return;
+        }
+        println("\tje\t.L.bb.%d", ins->els->id);
+        if (ins->bb->next != ins->then)
+            println("\tjmp\t.L.bb.%d", ins->then->id);
+        return;
+    case IR_RET:
+        if (ins->nops)
+            fetch(ins->ops[0], "%rax");
+        if (ins->bb->next)
+            println("\tjmp\t.L.return.%s", cur_fn->fn->name);
+        return;
+    }
+    gen_binary(ins);
+}
+
+/*  give stack slots to the locals that were not promoted, in the
+    same order as the AST code generator lays them out.   */
+static void assign_slots(IRFunc *f) {
+    for (Obj *var = f->fn->locals; var; var = var->next)
+        var->offset = 0;
+
+    for (BB *bb = f->bbs; bb; bb = bb->next)
+        for (Ins *ins = bb->ins; ins; ins = ins->next)
+            if (ins->kind == IR_LADDR)
+                ins->var->offset = 1;
+
+    for (Obj *var = f->fn->locals; var; var = var->next) {
+        if (!var->offset)
+            continue;
+        frame_size += var->ty->size;
+        frame_size = align_to(frame_size, var->ty->align);
+        var->offset = -frame_size;
+    }
+}
+
+void gen_ir(IRFunc *f) {
+    cur_fn = f;
+    frame_size = 0;
+    used_regs = 0;
+
+    split_critical_edges(f);
+
+    assign_slots(f);
+
+    compute_intervals(f);
+    linear_scan(f);
+
+    int saved[NUM_CALLEE_SAVED];
+    int nsaved = 0;
+    for (int r = 0; r < NUM_CALLEE_SAVED; r++) {
+        if (used_regs & (1 << r)) {
+            frame_size += 8;
+            saved[nsaved++] = r;
+        }
+    }
+
+    println("\tpush\t%%rbp");
+    println("\tmov\t%%rsp, %%rbp");
+    println("\tsub\t$%d, %%rsp", align_to(frame_size, 16));
+    for (int i = 0; i < nsaved; i++)
+        println("\tmov\t%s, %d(%%rbp)", reg64[saved[i]], -frame_size + i * 8);
+
+    for (BB *bb = f->bbs; bb; bb = bb->next) {
+        println(".L.bb.%d:", bb->id);
+        for (Ins *ins = bb->ins; ins; ins = ins->next)
+            gen_ins(ins);
+    }
+
+    println(".L.return.%s:", f->fn->name);
+    for (int i = 0; i < nsaved; i++)
+        println("\tmov\t%d(%%rbp), %s", -frame_size + i * 8, reg64[saved[i]]);
+    println("\tmov\t%%rbp, %%rsp");
+    println("\tpop\t%%rbp");
+    println("\tret");
+
+    free(ins_pos);
+    free(call_pos);
+    free(start);
+    free(end);
+}
@@ -0,0 +1,329 @@
+#include "c.h"
+
+/*  loop-invariant code motion.
+
+    an expression inside a 'for' or 'while' loop whose value cannot
+    change while the loop runs is computed once into a fresh local
+    before the first test, and the loop reads that local instead.  the
+    inputs may be constants, addresses of variables, and locals that
+    the loop never assigns and whose address is never taken.  loads
+    through pointers stay in the loop since a store or a call could
+    change the memory, and so does division by anything but a safe
+    constant because the hoisted copy runs even if the body does not.
+
+    outer loops are visited first, so an expression that does not
+    depend on either of two nested loops leaves both of them.        */
+
+typedef struct VarList VarList;
+struct VarList {
+    VarList *next;
+    Obj *var;
+};
+
+static Obj *current_fn;
+static VarList *addr_taken;     /* locals whose address is computed */
+static VarList *written;        /* locals assigned in the current loop  */
+static Node *hoisted;           /* assignments for the preheader    */
+static Node *hoisted_last;
+
+static bool in_list(VarList *list, Obj *var) {
+    for (VarList *v = list; v; v = v->next)
+        if (v->var == var)
+            return true;
+    return false;
+}
+
+static VarList *add_var(VarList *list, Obj *var) {
+    VarList *v = calloc(1, sizeof(VarList));
+    v->var = var;
+    v->next = list;
+    return v;
+}
+
+static void find_addr_taken(Node *node) {
+    if (!node)
+        return;
+
+    if (node->kind == ND_ADDR) {
+        Node *n = node->lhs;
+        while (n->kind == ND_MEMBER)
+            n = n->lhs;
+        if (n->kind == ND_VAR && n->var->is_local)
+            addr_taken = add_var(addr_taken, n->var);
+    }
+
+    find_addr_taken(node->lhs);
+    find_addr_taken(node->rhs);
+    find_addr_taken(node->cond);
+    find_addr_taken(node->then);
+    find_addr_taken(node->els);
+    find_addr_taken(node->init);
+    find_addr_taken(node->inc);
+    for (Node *n = node->body; n; n = n->next)
+        find_addr_taken(n);
+    for (Node *n = node->args; n; n = n->next)
+        find_addr_taken(n);
+}
+
+static void find_written(Node *node) {
+    if (!node)
+        return;
+
+    if (node->kind == ND_ASSIGN && node->lhs->kind == ND_VAR)
+        written = add_var(written, node->lhs->var);
+    if (node->kind == ND_MEMZERO)
+        written = add_var(written, node->var);
+
+    find_written(node->lhs);
+    find_written(node->rhs);
+    find_written(node->cond);
+    find_written(node->then);
+    find_written(node->els);
+    find_written(node->init);
+    find_written(node->inc);
+    for (Node *n = node->body; n; n = n->next)
+        find_written(n);
+    for (Node *n = node->args; n; n = n->next)
+        find_written(n);
+}
+
+/*  true if control can enter the loop somewhere other than its top,
+    through a label or a case of a switch that encloses the loop.   */
+static bool has_entry(Node *node, bool in_switch) {
+    if (!node)
+        return false;
+    if (node->kind == ND_LABEL || (node->kind == ND_CASE && !in_switch))
+        return true;
+    if (node->kind == ND_SWITCH)
+        return has_entry(node->cond, in_switch) || has_entry(node->then, true);
+
+    if (has_entry(node->lhs, in_switch) || has_entry(node->rhs, in_switch) ||
+        has_entry(node->cond, in_switch) || has_entry(node->then, in_switch) ||
+        has_entry(node->els, in_switch) || has_entry(node->init, in_switch) ||
+        has_entry(node->inc, in_switch))
+        return true;
+    for (Node *n = node->body; n; n = n->next)
+        if (has_entry(n, in_switch))
+            return true;
+    return false;
+}
+
+static bool is_invariant(Node *node);
+
+/*  true if the address 'node' designates does not change in the loop. */
+static bool is_invariant_addr(Node *node) {
+    switch (node->kind) {
+    case ND_VAR:
+        return true;
+    case ND_DEREF:
+        return is_invariant(node->lhs);
+    case ND_MEMBER:
+        return is_invariant_addr(node->lhs);
+    }
+    return false;
+}
+
+static bool is_invariant(Node *node) {
+    if (!node)
+        return true;
+
+    switch (node->kind) {
+    case ND_NUM:
+        return is_integer(node->ty);
+    case ND_VAR:
+        /*  an array evaluates to its address.  */
+        if (node->ty->kind == TY_ARRAY)
+            return true;
+        return node->var->is_local && (is_integer(node->ty) || node->ty->kind == TY_PTR) &&
+               !in_list(written, node->var) && !in_list(addr_taken, node->var);
+    case ND_ADDR:
+        return is_invariant_addr(node->lhs);
+    case ND_DEREF:
+        /*  an array element that is itself an array is not loaded.  */
+        if (node->ty->kind == TY_ARRAY)
+            return is_invariant(node->lhs);
+        return false;
+    case ND_MEMBER:
+        if (node->ty->kind == TY_ARRAY)
+            return is_invariant_addr(node->lhs);
+        return false;
+    case ND_DIV:
+    case ND_MOD:
+        if (node->rhs->kind != ND_NUM || node->rhs->val == 0 || node->rhs->val == -1)
+            return false;
+        return is_invariant(node->lhs);
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_BITAND:
+    case ND_BITOR:
+    case ND_BITXOR:
+    case ND_SHL:
+    case ND_SHR:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LT:
+    case ND_LE:
+    case ND_NEG:
+    case ND_NOT:
+    case ND_BITNOT:
+    case ND_CAST:
+    case ND_LOGAND:
+    case ND_LOGOR:
+    case ND_COMMA:
+        return is_invariant(node->lhs) && is_invariant(node->rhs);
+    case ND_COND:
+        return is_invariant(node->cond) && is_invariant(node->then) && is_invariant(node->els);
+    }
+    return false;
+}
+
+/*  a variable, a constant or a plain address costs no more to reload
+    than the temporary that would replace it.   */
+static bool is_worth_hoisting(Node *node) {
+    while (node->kind == ND_CAST)
+        node = node->lhs;
+
+    switch (node->kind) {
+    case ND_NUM:
+    case ND_VAR:
+        return false;
+    case ND_ADDR:
+        return node->lhs->kind != ND_VAR;
+    }
+    return is_integer(node->ty) || node->ty->kind == TY_PTR;
+}
+
+static Node *new_node(NodeKind kind, Token *tok) {
+    Node *node = calloc(1, sizeof(Node));
+    node->kind = kind;
+    node->tok = tok;
+    return node;
+}
+
+/*  move 'node' to the preheader and return a read of its value.   */
+static Node *hoist(Node *node) {
+    node->next = NULL;
+
+    Obj *var = calloc(1, sizeof(Obj));
+    var->name = "";
+    var->ty = node->ty;
+    var->is_local = true;
+    var->next = current_fn->locals;
+    current_fn->locals = var;
+
+    Node *ref = new_node(ND_VAR, node->tok);
+    ref->var = var;
+    ref->ty = node->ty;
+
+    Node *assign = new_node(ND_ASSIGN, node->tok);
+    assign->lhs = ref;
+    assign->rhs = node;
+    assign->ty = node->ty;
+
+    Node *stmt = new_node(ND_EXPR_STMT, node->tok);
+    stmt->lhs = assign;
+    if (hoisted_last)
+        hoisted_last = hoisted_last->next = stmt;
+    else
+        hoisted = hoisted_last = stmt;
+
+    Node *use = new_node(ND_VAR, node->tok);
+    use->var = var;
+    use->ty = node->ty;
+    return use;
+}
+
+/*  replace the largest invariant subtrees of 'node'.   */
+static Node *hoist_expr(Node *node) {
+    if (!node)
+        return NULL;
+    if (node->ty && is_worth_hoisting(node) && is_invariant(node))
+        return hoist(node);
+
+    node->lhs = hoist_expr(node->lhs);
+    node->rhs = hoist_expr(node->rhs);
+    node->cond = hoist_expr(node->cond);
+    node->then = hoist_expr(node->then);
+    node->els = hoist_expr(node->els);
+    node->init = hoist_expr(node->init);
+    node->inc = hoist_expr(node->inc);
+
+    for (Node **p = &node->body; *p; p = &(*p)->next) {
+        Node *next = (*p)->next;
+        *p = hoist_expr(*p);
+        (*p)->next = next;
+    }
+    for (Node **p = &node->args; *p; p = &(*p)->next) {
+        Node *next = (*p)->next;
+        *p = hoist_expr(*p);
+        (*p)->next = next;
+    }
+    return node;
+}
+
+static void visit(Node *node);
+
+static void hoist_loop(Node *node) {
+    if (has_entry(node->cond, false) || has_entry(node->then, false) ||
+        has_entry(node->inc, false))
+        return;
+
+    written = NULL;
+    find_written(node->cond);
+    find_written(node->then);
+    find_written(node->inc);
+
+    Obj *outer = current_fn->locals;
+    hoisted = hoisted_last = NULL;
+    node->cond = hoist_expr(node->cond);
+    node->then = hoist_expr(node->then);
+    node->inc = hoist_expr(node->inc);
+    if (!hoisted)
+        return;
+
+    for (Obj *var = current_fn->locals; var != outer; var = var->next)
+        var->scope = node;
+
+    /*  the preheader runs after the loop's own initialization.  */
+    Node *pre = new_node(ND_BLOCK, node->tok);
+    if (node->init) {
+        pre->body = node->init;
+        node->init->next = hoisted;
+    } else {
+        pre->body = hoisted;
+    }
+    node->init = pre;
+}
+
+static void visit(Node *node) {
+    if (!node)
+        return;
+
+    if (node->kind == ND_FOR)
+        hoist_loop(node);
+
+    visit(node->lhs);
+    visit(node->rhs);
+    visit(node->cond);
+    visit(node->then);
+    visit(node->els);
+    visit(node->init);
+    visit(node->inc);
+    for (Node *n = node->body; n; n = n->next)
+        visit(n);
+    for (Node *n = node->args; n; n = n->next)
+        visit(n);
+}
+
+void hoist_loop_invariants(Obj *prog) {
+    for (Obj *fn = prog; fn; fn = fn->next) {
+        if (!fn->is_function || !fn->is_definition)
+            continue;
+
+        current_fn = fn;
+        addr_taken = NULL;
+        find_addr_taken(fn->body);
+        visit(fn->body);
+    }
+}
@@ -1,14 +1,38 @@
 #include "c.h"
 
+int opt_level;
+bool opt_fssa;
+bool opt_fdump_ir;
+bool opt_fpeephole_stats;
+bool opt_fomit_frame_pointer;
+char *opt_fprofile_generate;
+char *opt_fprofile_use;
+
 static char *opt_o;
 
 static char *input_path;
 
 static void usage(int status) {
-    fprintf(stderr, "mycc [ -o <path> ] <file>\n");
+    fprintf(stderr, "mycc [ -o <path> ] [ -O<level> ] [ -fssa ] [ -fdump-ir ] [ -fpeephole-stats ]\n"
+                    "     [ -fomit-frame-pointer ] [ -fprofile-generate[=<path>] ]\n"
+                    "     [ -fprofile-use[=<path>] ] <file>\n");
     exit(status);
 }
 
+/*  the profile of 'dir/foo.c' is 'dir/foo.prof' unless 'path' names
+    one.  every translation unit keeps its own.   */
+static char *profile_path(char *path) {
+    if (*path)
+        return path;
+    if (!strcmp(input_path, "-"))
+        return "mycc.prof";
+
+    char *dot = strrchr(input_path, '.');
+    char *slash = strrchr(input_path, '/');
+    int len = (dot && (!slash || dot > slash)) ? dot - input_path : strlen(input_path);
+    return format("%.*s.prof", len, input_path);
+}
+
 static void parse_args(int argc, char **argv) {
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "--help"))
@@ -26,6 +50,59 @@ static void parse_args(int argc, char **argv) {
             continue;
         }
 
+        /*  -O is the same as -O1   */
+        if (!strncmp(argv[i], "-O", 2)) {
+            char *p = argv[i] + 2;
+            opt_level = *p ? strtol(p, &p, 10) : 1;
+            if (*p)
+                error("invalid optimization level: %s", argv[i]);
+            continue;
+        }
+
+        /*  generate code through the SSA IR instead of from the AST. */
+        if (!strcmp(argv[i], "-fssa")) {
+            opt_fssa = true;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fdump-ir")) {
+            opt_fdump_ir = true;
+            continue;
+        }
+
+        /*  report what each peephole rule removed.  */
+        if (!strcmp(argv[i], "-fpeephole-stats")) {
+            opt_fpeephole_stats = true;
+            continue;
+        }
+
+        /*  non-leaf functions drop %rbp too; leaf ones do at any -O.  */
+        if (!strcmp(argv[i], "-fomit-frame-pointer")) {
+            opt_fomit_frame_pointer = true;
+            continue;
+        }
+
+        /*  without a path, the profile is named after the input.  */
+        if (!strcmp(argv[i], "-fprofile-generate")) {
+            opt_fprofile_generate = "";
+            continue;
+        }
+
+        if (!strncmp(argv[i], "-fprofile-generate=", 19)) {
+            opt_fprofile_generate = argv[i] + 19;
+            continue;
+        }
+
+        if (!strcmp(argv[i], "-fprofile-use")) {
+            opt_fprofile_use = "";
+            continue;
+        }
+
+        if (!strncmp(argv[i], "-fprofile-use=", 14)) {
+            opt_fprofile_use = argv[i] + 14;
+            continue;
+        }
+
         if (argv[i][0] == '-' && argv[i][1] != '\0')
             error("unknown argument: %s", argv[i]);
         
@@ -33,6 +110,15 @@ static void parse_args(int argc, char **argv) {
     }
     if (!input_path)
         error("no input files");
+
+    if (opt_fprofile_generate)
+        opt_fprofile_generate = profile_path(opt_fprofile_generate);
+    if (opt_fprofile_use)
+        opt_fprofile_use = profile_path(opt_fprofile_use);
+
+    /*  the IR backend has no counters to bump.  */
+    if (opt_fssa && opt_fprofile_generate)
+        error("-fprofile-generate does not work with -fssa");
 }
 
 static FILE *open_file(char *path) {
@@ -51,10 +137,22 @@ int main(int argc, char *argv[]) {
     /*  tokenize and parse. */
     Token *tok = tokenize_file(input_path);
     Obj *prog = parse(tok);
+    if (opt_fprofile_generate || opt_fprofile_use)
+        assign_profile_ids(prog);
+    if (opt_fprofile_use)
+        read_profile(opt_fprofile_use);
+    if (opt_level) {
+        inline_functions(prog);
+        fold_constants(prog);
+        hoist_loop_invariants(prog);
+        eliminate_common_subexprs(prog);
+    }
     
     /* traverse the ast to emit assembly. */
     FILE *out = open_file(opt_o);
     fprintf(out, ".file 1 \"%s\"\n", input_path);
     codegen(prog, out);
+    if (opt_fpeephole_stats)
+        print_peephole_stats(stderr);
     return 0;
 }
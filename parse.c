@@ -76,6 +76,10 @@ static char *cont_label;
 /*  points to a node representing a switch if parsing a switch statement. otherwise, NULL   */
 static Node *current_switch;
 
+/*  the innermost block or "for" whose scope new locals belong to.
+    NULL while the parameters are declared.     */
+static Node *current_block;
+
 static bool is_typename(Token *tok);
 static Type *declspec(Token **rest, Token *tok, VarAttr *attr);
 static Type *enum_specifier(Token **rest, Token *tok);
@@ -92,6 +96,8 @@ static Node *expr(Token **rest, Token *tok);
 static Node *assign(Token **rest, Token *tok);
 static Node *logor(Token **rest, Token *tok);
 static int64_t const_expr(Token **rest, Token *tok);
+static int64_t eval(Node *node);
+static bool is_const_init(Node *node);
 static Node *conditional(Token **rest, Token *tok);
 static Node *logand(Token **rest, Token *tok);
 static Node *bitor(Token **rest, Token *tok);
@@ -234,6 +240,7 @@ static Obj *new_var(char *name, Type *ty) {
 static Obj *new_lvar(char *name, Type *ty) {
     Obj *var = new_var(name, ty);
     var->is_local = true;
+    var->scope = current_block;
     var->next = locals;
     locals = var;
     return var;
@@ -251,7 +258,9 @@ static char *new_unique_name(void) {
 }
 
 static Obj *new_anon_gvar(Type *ty) {
-    return new_gvar(new_unique_name(), ty);
+    Obj *var = new_gvar(new_unique_name(), ty);
+    var->is_static = true;
+    return var;
 }
 
 static Obj *new_string_literal(char *p, Type *ty) {
@@ -688,13 +697,24 @@ static Node *init_desg_expr(InitDesg *desg, Token *tok) {
     return new_unary(ND_DEREF, new_add(lhs, rhs, tok), tok);
 }
 
-static Node *create_lvar_init(Initializer *init, Type *ty, InitDesg *desg, Token *tok) {
+/*  join the stores of an initializer, leaving out the empty ones.  */
+static Node *join_init(Node *node, Node *rhs, Token *tok) {
+    if (rhs->kind == ND_NULL_EXPR)
+        return node;
+    if (node->kind == ND_NULL_EXPR)
+        return rhs;
+    return new_binary(ND_COMMA, node, rhs, tok);
+}
+
+/*  'skip_const' leaves out the elements a template already holds.  */
+static Node *create_lvar_init(Initializer *init, Type *ty, InitDesg *desg, Token *tok,
+                              bool skip_const) {
     if (ty->kind == TY_ARRAY) {
         Node *node = new_node(ND_NULL_EXPR, tok);
         for (int i = 0; i < ty->array_len; i++) {
             InitDesg desg2 = {desg, i};
-            Node *rhs = create_lvar_init(init->children[i], ty->base, &desg2, tok);
-            node = new_binary(ND_COMMA, node, rhs, tok);
+            Node *rhs = create_lvar_init(init->children[i], ty->base, &desg2, tok, skip_const);
+            node = join_init(node, rhs, tok);
         }
         return node;
     }
@@ -704,27 +724,135 @@ static Node *create_lvar_init(Initializer *init, Type *ty, InitDesg *desg, Token
 
         for (Member *mem = ty->members; mem; mem = mem->next) {
             InitDesg desg2 = {desg, 0, mem};
-            Node *rhs = create_lvar_init(init->children[mem->idx], mem->ty, &desg2, tok);
-            node = new_binary(ND_COMMA, node, rhs, tok);
+            Node *rhs = create_lvar_init(init->children[mem->idx], mem->ty, &desg2, tok,
+                                         skip_const);
+            node = join_init(node, rhs, tok);
         }
         return node;
     }
 
-    if (!init->expr)
+    if (!init->expr || (skip_const && is_const_init(init->expr)))
         return new_node(ND_NULL_EXPR, tok);
 
     Node *lhs = init_desg_expr(desg, tok);    
     return new_binary(ND_ASSIGN, lhs, init->expr, tok);
 }
 
+/*  store the constant elements of an initializer into 'buf'.  returns
+    true if any of them is not zero.    */
+static bool write_template(Initializer *init, Type *ty, char *buf, int offset) {
+    bool nonzero = false;
+
+    if (ty->kind == TY_ARRAY) {
+        for (int i = 0; i < ty->array_len; i++)
+            nonzero |= write_template(init->children[i], ty->base, buf,
+                                      offset + ty->base->size * i);
+        return nonzero;
+    }
+
+    if (ty->kind == TY_STRUCT) {
+        for (Member *mem = ty->members; mem; mem = mem->next)
+            nonzero |= write_template(init->children[mem->idx], mem->ty, buf,
+                                      offset + mem->offset);
+        return nonzero;
+    }
+
+    if (!init->expr || !is_const_init(init->expr))
+        return false;
+
+    int64_t val = eval(init->expr);
+    if (ty->kind == TY_BOOL)
+        val = (val != 0);
+    for (int i = 0; i < ty->size; i++)
+        buf[offset + i] = val >> (i * 8);
+    return val != 0;
+}
+
+/*  flag the bytes that the initializer of a local stores.  */
+static void mark_covered(Initializer *init, Type *ty, char *covered, int offset) {
+    if (ty->kind == TY_ARRAY) {
+        for (int i = 0; i < ty->array_len; i++)
+            mark_covered(init->children[i], ty->base, covered, offset + ty->base->size * i);
+        return;
+    }
+
+    if (ty->kind == TY_STRUCT) {
+        for (Member *mem = ty->members; mem; mem = mem->next)
+            mark_covered(init->children[mem->idx], mem->ty, covered, offset + mem->offset);
+        return;
+    }
+
+    if (init->expr)
+        memset(covered + offset, 1, ty->size);
+}
+
+/*  clear what the initializer of a local leaves out, one ND_MEMZERO
+    per range of bytes.  nothing is cleared if the initializer covers
+    the whole object, and all of it if the gaps are too scattered.  */
+#define MAX_ZERO_RANGES 4
+
+static Node *zero_uncovered(Obj *var, char *covered, Token *tok) {
+    int size = var->ty->size;
+    Node *node = new_node(ND_NULL_EXPR, tok);
+    int nranges = 0;
+
+    for (int i = 0; i < size;) {
+        if (covered[i]) {
+            i++;
+            continue;
+        }
+
+        int j = i;
+        while (j < size && !covered[j])
+            j++;
+
+        Node *zero = new_node(ND_MEMZERO, tok);
+        zero->var = var;
+        if (j - i < size) {
+            zero->zero_offset = i;
+            zero->zero_len = j - i;
+        }
+        node = join_init(node, zero, tok);
+        nranges++;
+        i = j;
+    }
+
+    if (nranges <= MAX_ZERO_RANGES)
+        return node;
+    node = new_node(ND_MEMZERO, tok);
+    node->var = var;
+    return node;
+}
+
+/*  a local of at least this many bytes whose initializer has nonzero
+    constant elements is copied from a read-only template holding them,
+    and only the other elements are stored one by one.   */
+#define INIT_TEMPLATE_MIN 64
+
 static Node *lvar_initializer(Token **rest, Token *tok, Obj *var) {
     Initializer *init = initializer(rest, tok, var->ty, &var->ty);
     InitDesg desg = {NULL, 0, NULL, var};
 
-    Node *lhs = new_node(ND_MEMZERO, tok);
-    lhs->var = var;
-    Node *rhs = create_lvar_init(init, var->ty, &desg, tok);
-    return new_binary(ND_COMMA, lhs, rhs, tok);
+    if (var->ty->size >= INIT_TEMPLATE_MIN) {
+        char *buf = calloc(1, var->ty->size);
+        if (write_template(init, var->ty, buf, 0)) {
+            Obj *tmpl = new_anon_gvar(var->ty);
+            tmpl->init_data = buf;
+            tmpl->is_readonly = true;
+
+            /*  an array assignment that only codegen can express.  */
+            Node *lhs = new_binary(ND_ASSIGN, new_var_node(var, tok), new_var_node(tmpl, tok), tok);
+            lhs->ty = lhs->lhs->ty = lhs->rhs->ty = var->ty;
+            Node *rhs = create_lvar_init(init, var->ty, &desg, tok, true);
+            return join_init(lhs, rhs, tok);
+        }
+    }
+
+    char *covered = calloc(1, var->ty->size);
+    mark_covered(init, var->ty, covered, 0);
+    Node *lhs = zero_uncovered(var, covered, tok);
+    Node *rhs = create_lvar_init(init, var->ty, &desg, tok, false);
+    return join_init(lhs, rhs, tok);
 }
 
 /*  return true if a given token represents a type. */
@@ -826,6 +954,8 @@ static Node *stmt(Token **rest, Token *tok) {
         Node *node = new_node(ND_FOR, tok);
         tok = skip(tok->next, "(");
 
+        Node *blk = current_block;
+        current_block = node;
         enter_scope();
 
         char *brk = brk_label;
@@ -851,6 +981,7 @@ static Node *stmt(Token **rest, Token *tok) {
         node->then = stmt(rest, tok);
 
         leave_scope();
+        current_block = blk;
         brk_label = brk;
         cont_label = cont;
         return node;
@@ -922,6 +1053,8 @@ static Node *compound_stmt(Token **rest, Token *tok) {
     Node head = {};
     Node *cur = &head;
 
+    Node *blk = current_block;
+    current_block = node;
     enter_scope();
 
     while (!equal(tok, "}")) {
@@ -941,6 +1074,7 @@ static Node *compound_stmt(Token **rest, Token *tok) {
     }
 
     leave_scope();
+    current_block = blk;
 
     node->body = head.next;
     *rest = tok->next;
@@ -1037,13 +1171,106 @@ static int64_t const_expr(Token **rest, Token *tok) {
     return eval(node);
 }
 
-/*  convert 'A op= B' to 'tmp = &A, *tmp = *tmp op B'
-    where tmp is a fresh pointer variable.              */
+/*  true if eval can compute the value of 'node'.  */
+static bool is_const_init(Node *node) {
+    if (!node)
+        return true;
+
+    switch (node->kind) {
+    case ND_NUM:
+        return true;
+    case ND_DIV:
+    case ND_MOD:
+        return is_const_init(node->lhs) && is_const_init(node->rhs) && eval(node->rhs) != 0;
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_NEG:
+    case ND_BITAND:
+    case ND_BITOR:
+    case ND_BITXOR:
+    case ND_SHL:
+    case ND_SHR:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LT:
+    case ND_LE:
+    case ND_COMMA:
+    case ND_NOT:
+    case ND_BITNOT:
+    case ND_LOGAND:
+    case ND_LOGOR:
+    case ND_CAST:
+        return is_const_init(node->lhs) && is_const_init(node->rhs);
+    case ND_COND:
+        return is_const_init(node->cond) && is_const_init(node->then) &&
+               is_const_init(node->els);
+    }
+    return false;
+}
+
+/*  true if evaluating 'node' has no effect other than its value.    */
+static bool is_pure(Node *node) {
+    if (!node)
+        return true;
+
+    switch (node->kind) {
+    case ND_VAR:
+    case ND_NUM:
+        return true;
+    case ND_MEMBER:
+    case ND_DEREF:
+    case ND_ADDR:
+    case ND_CAST:
+    case ND_NEG:
+    case ND_NOT:
+    case ND_BITNOT:
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_BITAND:
+    case ND_BITOR:
+    case ND_BITXOR:
+    case ND_SHL:
+    case ND_SHR:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LT:
+    case ND_LE:
+        return is_pure(node->lhs) && is_pure(node->rhs);
+    }
+    return false;
+}
+
+/*  true if 'node' designates the same object however often it is
+    evaluated: a variable or a member of one.   */
+static bool has_fixed_addr(Node *node) {
+    if (node->kind == ND_MEMBER)
+        return has_fixed_addr(node->lhs);
+    return node->kind == ND_VAR;
+}
+
+static Node *copy_expr(Node *node) {
+    if (!node)
+        return NULL;
+    Node *copy = calloc(1, sizeof(Node));
+    *copy = *node;
+    copy->lhs = copy_expr(node->lhs);
+    copy->rhs = copy_expr(node->rhs);
+    return copy;
+}
+
+/*  convert 'A op= B' to 'A = A op B' if evaluating A twice yields the
+    same object, and to 'tmp = &A, *tmp = *tmp op B' otherwise, where
+    tmp is a fresh pointer variable.     */
 static Node *to_assign(Node *binary) {
     add_type(binary->lhs);
     add_type(binary->rhs);
     Token *tok = binary->tok;
 
+    if (has_fixed_addr(binary->lhs) || (is_pure(binary->lhs) && is_pure(binary->rhs)))
+        return new_binary(ND_ASSIGN, copy_expr(binary->lhs), binary, tok);
+
     Obj *var = new_lvar("", pointer_to(binary->lhs->ty));
 
     Node *expr1 = new_binary(ND_ASSIGN, new_var_node(var, tok),
@@ -1615,8 +1842,14 @@ static Node *primary(Token **rest, Token *tok) {
     if (equal(tok, "(") && equal(tok->next, "{")) {
         /*  This is a GNU statement expression. */
         Node *node = new_node(ND_STMT_EXPR, tok);
-        node->body = compound_stmt(&tok, tok->next->next)->body;
+        Node *blk = compound_stmt(&tok, tok->next->next);
+        node->body = blk->body;
         *rest = skip(tok, ")");
+
+        /*  the block itself does not stay in the tree.  */
+        for (Obj *var = locals; var; var = var->next)
+            if (var->scope == blk)
+                var->scope = node;
         return node;
     }
 
@@ -1720,6 +1953,7 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
 
     current_fn = fn;
     locals = NULL;
+    current_block = NULL;
     enter_scope();
     create_param_lvars(ty->params);
     fn->params = locals;
@@ -1732,7 +1966,7 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
     return tok;
 }
 
-static Token *global_variable(Token *tok, Type *basety) {
+static Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
     bool first = true;
 
     while (!consume(&tok, tok, ";")) {
@@ -1741,7 +1975,8 @@ static Token *global_variable(Token *tok, Type *basety) {
         first = false;
 
         Type *ty = declarator(&tok, tok, basety);
-        new_gvar(get_ident(ty->name), ty);
+        Obj *var = new_gvar(get_ident(ty->name), ty);
+        var->is_static = attr->is_static;
     }
     return tok;
 }
@@ -1778,7 +2013,7 @@ Obj *parse(Token *tok) {
         }
 
         /*  global variable     */
-        tok = global_variable(tok, basety);
+        tok = global_variable(tok, basety, &attr);
     }        
     return globals;
 }
@@ -0,0 +1,344 @@
+#include "c.h"
+
+/*  peephole optimization over the assembly text of one function.
+
+    the text is split into lines and every instruction is parsed into its
+    mnemonic and operands.  each rule looks at an instruction and the ones
+    that follow it, skipping .loc directives, and rewrites or deletes them
+    in place.  a label ends the window since control may enter there.
+    the rules are applied until none of them fires.                     */
+
+typedef struct {
+    char *text;     /* the whole line, NULL once deleted    */
+    char *op;       /* mnemonic, NULL for labels and directives */
+    char *src;      /* first operand    */
+    char *dst;      /* second operand   */
+} Line;
+
+typedef struct {
+    char *name;
+    bool (*apply)(int i);
+    int applied;
+    int removed;
+} Rule;
+
+static Line *lines;
+static int nlines;
+static Rule *cur_rule;
+
+static void parse_line(Line *l) {
+    l->op = l->src = l->dst = NULL;
+    if (l->text[0] != '\t' || l->text[1] == '.')
+        return;
+
+    l->op = strndup(l->text + 1, strcspn(l->text + 1, "\t"));
+    char *p = l->text + 1 + strlen(l->op);
+    if (!*p)
+        return;
+    p++;
+
+    /*  the operands are separated by ", ", which memory operands lack. */
+    char *comma = strstr(p, ", ");
+    if (!comma) {
+        l->src = strdup(p);
+        return;
+    }
+    l->src = strndup(p, comma - p);
+    l->dst = strdup(comma + 2);
+}
+
+static void rewrite(int i, char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    char *buf;
+    size_t len;
+    FILE *out = open_memstream(&buf, &len);
+    vfprintf(out, fmt, ap);
+    fclose(out);
+    va_end(ap);
+
+    lines[i].text = buf;
+    parse_line(&lines[i]);
+}
+
+static void delete(int i) {
+    lines[i].text = NULL;
+    lines[i].op = NULL;
+    cur_rule->removed++;
+}
+
+static bool is_label(int i) {
+    return lines[i].text && lines[i].text[0] != '\t';
+}
+
+/*  the next line after 'i' that is not deleted and not a .loc.  */
+static int next_line(int i) {
+    for (i++; i < nlines; i++) {
+        if (!lines[i].text)
+            continue;
+        if (!strncmp(lines[i].text, "\t.loc", 5))
+            continue;
+        return i;
+    }
+    return -1;
+}
+
+/*  the next instruction after 'i' that control reaches only from 'i'.  */
+static Line *next_ins(int i, int *idx) {
+    int j = next_line(i);
+    if (j < 0 || !lines[j].op)
+        return NULL;
+    if (idx)
+        *idx = j;
+    return &lines[j];
+}
+
+static bool is_op(Line *l, char *op) {
+    return l && l->op && !strcmp(l->op, op);
+}
+
+static bool eq(char *a, char *b) {
+    return a && b && !strcmp(a, b);
+}
+
+static bool mentions_rax(char *s) {
+    return s && (strstr(s, "%rax") || strstr(s, "%eax") || strstr(s, "%ax") || strstr(s, "%al"));
+}
+
+static bool reads_flags(Line *l) {
+    if (!l || !l->op)
+        return true;
+    if (l->op[0] == 'j')
+        return strcmp(l->op, "jmp") != 0;
+    return !strncmp(l->op, "set", 3) || !strncmp(l->op, "cmov", 4) ||
+           !strcmp(l->op, "adc") || !strcmp(l->op, "sbb");
+}
+
+/*  true if %rax is overwritten before anything reads it.   */
+static bool rax_dead_after(int i) {
+    Line *l = next_ins(i, NULL);
+    if (!l)
+        return false;
+
+    static char *loads[] = {
+        "mov", "movslq", "movsxd", "movsbq", "movswq", "movsbl", "movswl",
+        "movzb", "movzx", "lea",
+    };
+    for (int k = 0; k < sizeof(loads) / sizeof(*loads); k++)
+        if (is_op(l, loads[k]))
+            return (eq(l->dst, "%rax") || eq(l->dst, "%eax")) && !mentions_rax(l->src);
+    return false;
+}
+
+/*  x86-64 registers by their 64-bit and 32-bit names.  */
+static char *reg64[] = {
+    "%rax", "%rbx", "%rcx", "%rdx", "%rsi", "%rdi", "%r8", "%r9",
+    "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+};
+static char *reg32[] = {
+    "%eax", "%ebx", "%ecx", "%edx", "%esi", "%edi", "%r8d", "%r9d",
+    "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d",
+};
+
+static char *to_reg32(char *reg) {
+    for (int k = 0; k < sizeof(reg64) / sizeof(*reg64); k++)
+        if (eq(reg, reg64[k]))
+            return reg32[k];
+    return NULL;
+}
+
+/*
+ *  rules
+ */
+
+/*  push %x; pop %y  =>  mov %x, %y     */
+static bool push_pop(int i) {
+    int j;
+    Line *l = &lines[i];
+    Line *m = next_ins(i, &j);
+    if (!is_op(l, "push") || !is_op(m, "pop"))
+        return false;
+
+    if (eq(l->src, m->src)) {
+        delete(i);
+        delete(j);
+        return true;
+    }
+    rewrite(i, "\tmov\t%s, %s", l->src, m->src);
+    delete(j);
+    return true;
+}
+
+/*  mov $0, %r  =>  xor %r32, %r32, unless the flags are read next.  */
+static bool zero_reg(int i) {
+    Line *l = &lines[i];
+    if (!is_op(l, "mov") || !eq(l->src, "$0"))
+        return false;
+
+    char *r32 = to_reg32(l->dst);
+    if (!r32 || reads_flags(next_ins(i, NULL)))
+        return false;
+    rewrite(i, "\txor\t%s, %s", r32, r32);
+    return true;
+}
+
+/*  jmp L; L:  =>  L:  */
+static bool jump_to_next(int i) {
+    Line *l = &lines[i];
+    if (!is_op(l, "jmp") || l->src[0] == '*')
+        return false;
+
+    for (int j = next_line(i); j >= 0 && is_label(j); j = next_line(j)) {
+        if (!strncmp(lines[j].text, l->src, strlen(l->src)) &&
+            lines[j].text[strlen(l->src)] == ':') {
+            delete(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static char *invert_cc(char *cc) {
+    static char *pairs[][2] = {
+        {"e", "ne"}, {"l", "ge"}, {"le", "g"}, {"b", "ae"}, {"be", "a"},
+    };
+    for (int k = 0; k < sizeof(pairs) / sizeof(*pairs); k++) {
+        if (!strcmp(cc, pairs[k][0]))
+            return pairs[k][1];
+        if (!strcmp(cc, pairs[k][1]))
+            return pairs[k][0];
+    }
+    return NULL;
+}
+
+/*  setCC %al; movzb %al, %rax; cmp $0, %rax; je L  =>  jNCC L
+    codegen never reads a value that it has just tested for a branch. */
+static bool set_branch(int i) {
+    int j, k, n;
+    Line *set = &lines[i];
+    if (!set->op || strncmp(set->op, "set", 3) || !eq(set->src, "%al"))
+        return false;
+
+    Line *ext = next_ins(i, &j);
+    if (!(is_op(ext, "movzb") || is_op(ext, "movzx")) || !eq(ext->src, "%al") ||
+        !eq(ext->dst, "%rax"))
+        return false;
+
+    Line *cmp = next_ins(j, &k);
+    if (!is_op(cmp, "cmp") || !eq(cmp->src, "$0") || !eq(cmp->dst, "%rax"))
+        return false;
+
+    Line *br = next_ins(k, &n);
+    if (!is_op(br, "je") && !is_op(br, "jne"))
+        return false;
+
+    char *cc = set->op + 3;
+    if (is_op(br, "je"))
+        cc = invert_cc(cc);
+    if (!cc)
+        return false;
+
+    rewrite(n, "\tj%s\t%s", cc, br->src);
+    delete(i);
+    delete(j);
+    delete(k);
+    return true;
+}
+
+/*  mov %rax, x; mov x, %rax  =>  mov %rax, x    */
+static bool store_reload(int i) {
+    int j;
+    Line *l = &lines[i];
+    Line *m = next_ins(i, &j);
+    if (!is_op(l, "mov") || !is_op(m, "mov") || !eq(l->src, "%rax"))
+        return false;
+    if (!eq(l->dst, m->src) || !eq(m->dst, "%rax"))
+        return false;
+    delete(j);
+    return true;
+}
+
+/*  mov %r, %r  =>  nothing, for 64-bit registers only: a 32-bit move
+    to itself clears the upper half.     */
+static bool self_move(int i) {
+    Line *l = &lines[i];
+    if (!is_op(l, "mov") || !to_reg32(l->src) || !eq(l->src, l->dst))
+        return false;
+    delete(i);
+    return true;
+}
+
+/*  mov x, %rax; mov %rax, %r  =>  mov x, %r, if %rax is dead after.  */
+static bool move_through_rax(int i) {
+    int j;
+    Line *l = &lines[i];
+    Line *m = next_ins(i, &j);
+    if (!is_op(l, "mov") || !is_op(m, "mov"))
+        return false;
+    if (!eq(l->dst, "%rax") || !eq(m->src, "%rax") || !to_reg32(m->dst))
+        return false;
+    if (mentions_rax(l->src) || !rax_dead_after(j))
+        return false;
+
+    rewrite(i, "\tmov\t%s, %s", l->src, m->dst);
+    delete(j);
+    return true;
+}
+
+static Rule rules[] = {
+    {"push-pop", push_pop},
+    {"zero-reg", zero_reg},
+    {"jump-to-next", jump_to_next},
+    {"set-branch", set_branch},
+    {"store-reload", store_reload},
+    {"self-move", self_move},
+    {"move-through-rax", move_through_rax},
+};
+
+#define NUM_RULES (sizeof(rules) / sizeof(*rules))
+
+/*  optimize the assembly in 'text' and return the new text.     */
+char *peephole(char *text) {
+    nlines = 0;
+    for (char *p = text; *p; p++)
+        if (*p == '\n')
+            nlines++;
+
+    lines = calloc(nlines, sizeof(Line));
+    char *p = text;
+    for (int i = 0; i < nlines; i++) {
+        char *nl = strchr(p, '\n');
+        lines[i].text = strndup(p, nl - p);
+        parse_line(&lines[i]);
+        p = nl + 1;
+    }
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 0; i < nlines; i++) {
+            for (int r = 0; r < NUM_RULES && lines[i].op; r++) {
+                cur_rule = &rules[r];
+                if (rules[r].apply(i)) {
+                    rules[r].applied++;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    char *buf;
+    size_t len;
+    FILE *out = open_memstream(&buf, &len);
+    for (int i = 0; i < nlines; i++)
+        if (lines[i].text)
+            fprintf(out, "%s\n", lines[i].text);
+    fclose(out);
+    free(lines);
+    return buf;
+}
+
+void print_peephole_stats(FILE *out) {
+    for (int r = 0; r < NUM_RULES; r++)
+        fprintf(out, "%-20s %6d applied %6d removed\n",
+                rules[r].name, rules[r].applied, rules[r].removed);
+}
@@ -0,0 +1,203 @@
+#include "c.h"
+
+/*  profile-guided optimization.
+
+    right after parsing, every branch point of the program gets a range
+    of counter numbers: the entry of a function, the two arms of an
+    'if' or '?:', the body of a loop, the right operand of '&&' and
+    '||', each case of a switch and each call.  the numbering depends
+    only on the source, so a program built with -fprofile-generate and
+    one built from the same source with -fprofile-use agree on it.
+
+    -fprofile-generate makes codegen bump a 64-bit counter wherever
+    control passes one of those points.  at exit the counters are added
+    to those already in the profile file, if it was written for the same
+    source, and written back.  the file holds a checksum of the
+    numbering, made from the name and counter range of every function,
+    followed by the counters themselves, all as 64-bit integers.  each
+    translation unit has its own file, by default the source path with
+    its extension replaced by '.prof'.
+
+    -fprofile-use reads the file back.  codegen then lays out the more
+    often taken arm of an 'if' as the fall-through path and tests the
+    dominant case of a switch before dispatching, and the inliner skips
+    calls that never ran and takes larger callees at hot call sites.  */
+
+static int num_counters;
+static int64_t *counts;
+static uint64_t checksum;
+
+/*  FNV-1a, one byte at a time.   */
+static void hash(void *p, int len) {
+    for (int i = 0; i < len; i++)
+        checksum = (checksum ^ ((unsigned char *)p)[i]) * 0x100000001b3;
+}
+
+static void number(Node *node) {
+    if (!node)
+        return;
+
+    switch (node->kind) {
+    case ND_IF:
+    case ND_COND:
+        node->prof_id = num_counters + 1;
+        num_counters += 2;
+        break;
+    case ND_FOR:
+    case ND_LOGAND:
+    case ND_LOGOR:
+    case ND_CASE:
+    case ND_FUNCALL:
+        node->prof_id = ++num_counters;
+        break;
+    }
+
+    number(node->lhs);
+    number(node->rhs);
+    number(node->cond);
+    number(node->then);
+    number(node->els);
+    number(node->init);
+    number(node->inc);
+    for (Node *n = node->body; n; n = n->next)
+        number(n);
+    for (Node *n = node->args; n; n = n->next)
+        number(n);
+}
+
+void assign_profile_ids(Obj *prog) {
+    checksum = 0xcbf29ce484222325;
+    for (Obj *fn = prog; fn; fn = fn->next) {
+        if (!fn->is_function || !fn->is_definition)
+            continue;
+
+        /*  the counter of the body counts calls of the function.  */
+        int first = fn->body->prof_id = ++num_counters;
+        number(fn->body);
+
+        hash(fn->name, strlen(fn->name) + 1);
+        hash(&first, sizeof(first));
+        hash(&num_counters, sizeof(num_counters));
+    }
+    hash(&num_counters, sizeof(num_counters));
+}
+
+/*  a profile written for a different program is ignored.  */
+void read_profile(char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in)
+        error("cannot open profile %s: %s", path, strerror(errno));
+
+    uint64_t sum;
+    int n = num_counters;
+    if (fread(&sum, sizeof(sum), 1, in) != 1 || sum != checksum) {
+        fprintf(stderr, "%s: profile does not match the program, ignored\n", path);
+        fclose(in);
+        return;
+    }
+
+    counts = calloc(n + 1, sizeof(int64_t));
+    if (fread(counts + 1, sizeof(int64_t), n, in) != n) {
+        fprintf(stderr, "%s: truncated profile, ignored\n", path);
+        free(counts);
+        counts = NULL;
+    }
+    fclose(in);
+}
+
+/*  the number of times control passed the k-th point of 'node', or -1
+    without a profile.   */
+int64_t profile_count(Node *node, int k) {
+    if (!counts || !node->prof_id)
+        return -1;
+    return counts[node->prof_id + k];
+}
+
+/*
+ *  instrumentation
+ */
+
+/*  count a pass through the k-th point of 'node'.  */
+void gen_counter(Node *node, int k) {
+    if (opt_fprofile_generate && node->prof_id)
+        println("\tincq\t.L.prof.counters+%d(%%rip)", (node->prof_id + k) * 8);
+}
+
+/*  the counters, and a function that .fini_array runs at exit to merge
+    them into the profile file.  */
+void emit_profile_runtime(void) {
+    int n = num_counters;
+
+    println("\t.data");
+    println("\t.align\t8");
+    println(".L.prof.counters:");
+    println("\t.quad\t%lu", checksum);
+    println("\t.zero\t%d", n * 8);
+    println("\t.bss");
+    println("\t.align\t8");
+    println(".L.prof.old:");
+    println("\t.zero\t%d", (n + 1) * 8);
+    println("\t.section\t.rodata");
+    /*  bytes, like other string data, so the path needs no escaping.  */
+    println(".L.prof.path:");
+    for (char *p = opt_fprofile_generate;; p++) {
+        println("\t.byte\t%d", *p);
+        if (!*p)
+            break;
+    }
+    println(".L.prof.rb:");
+    println("\t.string\t\"rb\"");
+    println(".L.prof.wb:");
+    println("\t.string\t\"wb\"");
+
+    println("\t.text");
+    println(".L.prof.dump:");
+    println("\tpush\t%%rbx");
+    println("\tlea\t.L.prof.path(%%rip), %%rdi");
+    println("\tlea\t.L.prof.rb(%%rip), %%rsi");
+    println("\tcall\tfopen@PLT");
+    println("\ttest\t%%rax, %%rax");
+    println("\tje\t.L.prof.write");
+    println("\tmov\t%%rax, %%rbx");
+    println("\tlea\t.L.prof.old(%%rip), %%rdi");
+    println("\tmov\t$8, %%esi");
+    println("\tmov\t$%d, %%edx", n + 1);
+    println("\tmov\t%%rbx, %%rcx");
+    println("\tcall\tfread@PLT");
+    println("\tmov\t%%rbx, %%rdi");
+    println("\tcall\tfclose@PLT");
+    println("\tmov\t.L.prof.counters(%%rip), %%rax");
+    println("\tcmp\t%%rax, .L.prof.old(%%rip)");
+    println("\tjne\t.L.prof.write");
+    println("\tlea\t.L.prof.old(%%rip), %%rsi");
+    println("\tlea\t.L.prof.counters(%%rip), %%rdi");
+    println("\tmov\t$%d, %%ecx", n);
+    println("\ttest\t%%rcx, %%rcx");
+    println("\tje\t.L.prof.write");
+    println(".L.prof.add:");
+    println("\tmov\t(%%rsi,%%rcx,8), %%rax");
+    println("\tadd\t%%rax, (%%rdi,%%rcx,8)");
+    println("\tdec\t%%rcx");
+    println("\tjne\t.L.prof.add");
+    println(".L.prof.write:");
+    println("\tlea\t.L.prof.path(%%rip), %%rdi");
+    println("\tlea\t.L.prof.wb(%%rip), %%rsi");
+    println("\tcall\tfopen@PLT");
+    println("\ttest\t%%rax, %%rax");
+    println("\tje\t.L.prof.done");
+    println("\tmov\t%%rax, %%rbx");
+    println("\tlea\t.L.prof.counters(%%rip), %%rdi");
+    println("\tmov\t$8, %%esi");
+    println("\tmov\t$%d, %%edx", n + 1);
+    println("\tmov\t%%rbx, %%rcx");
+    println("\tcall\tfwrite@PLT");
+    println("\tmov\t%%rbx, %%rdi");
+    println("\tcall\tfclose@PLT");
+    println(".L.prof.done:");
+    println("\tpop\t%%rbx");
+    println("\tret");
+
+    println("\t.section\t.fini_array,\"aw\"");
+    println("\t.align\t8");
+    println("\t.quad\t.L.prof.dump");
+}
@@ -0,0 +1,278 @@
+#include "c.h"
+
+/*  linear-scan register allocation for scalar local variables.
+
+    the nodes of a function body are numbered in the order codegen emits
+    them and each local gets a live interval from its first to its last
+    reference.  an interval overlapping a loop is stretched over the whole
+    loop because its value may flow around the back edge.  intervals are
+    then visited in order of their start points and handed one of the
+    callee-saved registers; when all of them are busy, the interval that
+    ends last is left on the stack (Poletto and Sarkar).               */
+
+typedef struct Interval Interval;
+struct Interval {
+    Interval *next;
+    Obj *var;
+    int start;
+    int end;
+    bool addr_taken;
+};
+
+/*  a range of positions that control can flow back through.    */
+typedef struct Loop Loop;
+struct Loop {
+    Loop *next;
+    int start;
+    int end;
+};
+
+/*  position of a label or a goto, used to find backward jumps.   */
+typedef struct Jump Jump;
+struct Jump {
+    Jump *next;
+    char *label;
+    int pos;
+};
+
+static Interval *intervals;
+static Loop *loops;
+static Jump *label_pos;
+static Jump *goto_pos;
+static int pos;
+
+static void scan(Node *node);
+
+static bool is_candidate(Obj *var) {
+    return var->is_local && (is_integer(var->ty) || var->ty->kind == TY_PTR);
+}
+
+static Interval *get_interval(Obj *var) {
+    for (Interval *iv = intervals; iv; iv = iv->next)
+        if (iv->var == var)
+            return iv;
+
+    Interval *iv = calloc(1, sizeof(Interval));
+    iv->var = var;
+    iv->start = pos;
+    iv->next = intervals;
+    intervals = iv;
+    return iv;
+}
+
+static void use(Obj *var) {
+    if (is_candidate(var))
+        get_interval(var)->end = pos;
+}
+
+static void add_loop(int start, int end) {
+    Loop *loop = calloc(1, sizeof(Loop));
+    loop->start = start;
+    loop->end = end;
+    loop->next = loops;
+    loops = loop;
+}
+
+static Jump *new_jump(Jump *next, char *label) {
+    Jump *j = calloc(1, sizeof(Jump));
+    j->label = label;
+    j->pos = pos;
+    j->next = next;
+    return j;
+}
+
+/*  visit a node that codegen evaluates as an address.  */
+static void scan_addr(Node *node) {
+    pos++;
+
+    switch (node->kind) {
+    case ND_VAR:
+        if (is_candidate(node->var)) {
+            use(node->var);
+            get_interval(node->var)->addr_taken = true;
+        }
+        return;
+    case ND_DEREF:
+        scan(node->lhs);
+        return;
+    case ND_COMMA:
+        scan(node->lhs);
+        scan_addr(node->rhs);
+        return;
+    case ND_MEMBER:
+        scan_addr(node->lhs);
+        return;
+    }
+    scan(node);
+}
+
+static void scan(Node *node) {
+    if (!node)
+        return;
+    pos++;
+
+    switch (node->kind) {
+    case ND_VAR:
+        use(node->var);
+        return;
+    case ND_MEMZERO:
+        use(node->var);
+        return;
+    case ND_MEMBER:
+        scan_addr(node->lhs);
+        return;
+    case ND_ADDR:
+        scan_addr(node->lhs);
+        return;
+    case ND_ASSIGN:
+        if (node->lhs->kind == ND_VAR) {
+            scan(node->rhs);
+            pos++;
+            use(node->lhs->var);
+        } else {
+            scan_addr(node->lhs);
+            scan(node->rhs);
+        }
+        return;
+    case ND_COMMA:
+    case ND_LOGAND:
+    case ND_LOGOR:
+        scan(node->lhs);
+        scan(node->rhs);
+        return;
+    case ND_IF:
+    case ND_COND:
+        scan(node->cond);
+        scan(node->then);
+        scan(node->els);
+        return;
+    case ND_FOR: {
+        scan(node->init);
+        int start = pos + 1;
+        scan(node->cond);
+        scan(node->then);
+        scan(node->inc);
+        add_loop(start, ++pos);
+        return;
+    }
+    case ND_SWITCH:
+        scan(node->cond);
+        scan(node->then);
+        return;
+    case ND_BLOCK:
+    case ND_STMT_EXPR:
+        for (Node *n = node->body; n; n = n->next)
+            scan(n);
+        return;
+    case ND_FUNCALL:
+        for (Node *n = node->args; n; n = n->next)
+            scan(n);
+        return;
+    case ND_LABEL:
+        label_pos = new_jump(label_pos, node->unique_label);
+        scan(node->lhs);
+        return;
+    case ND_GOTO:
+        goto_pos = new_jump(goto_pos, node->unique_label);
+        return;
+    }
+
+    /*  binary operators evaluate their right operand first.  */
+    scan(node->rhs);
+    scan(node->lhs);
+}
+
+/*  a goto to a label that precedes it closes a loop.   */
+static void add_backward_jumps(void) {
+    for (Jump *g = goto_pos; g; g = g->next)
+        for (Jump *l = label_pos; l; l = l->next)
+            if (!strcmp(g->label, l->label) && l->pos < g->pos)
+                add_loop(l->pos, g->pos);
+}
+
+static void extend_over_loops(void) {
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (Interval *iv = intervals; iv; iv = iv->next) {
+            for (Loop *loop = loops; loop; loop = loop->next) {
+                if (iv->end < loop->start || loop->end < iv->start)
+                    continue;
+                if (loop->start < iv->start) {
+                    iv->start = loop->start;
+                    changed = true;
+                }
+                if (iv->end < loop->end) {
+                    iv->end = loop->end;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+static int cmp_start(const void *a, const void *b) {
+    return (*(Interval **)a)->start - (*(Interval **)b)->start;
+}
+
+static void linear_scan(Interval **ivs, int n) {
+    Interval *active[NUM_LVAR_REGS + 1] = {};
+
+    for (int i = 0; i < n; i++) {
+        Interval *iv = ivs[i];
+
+        /*  release registers whose interval has ended.  */
+        for (int r = 1; r <= NUM_LVAR_REGS; r++)
+            if (active[r] && active[r]->end < iv->start)
+                active[r] = NULL;
+
+        int r = 1;
+        while (r <= NUM_LVAR_REGS && active[r])
+            r++;
+
+        if (r > NUM_LVAR_REGS) {
+            /*  spill whichever interval lives longest. */
+            r = 1;
+            for (int j = 2; j <= NUM_LVAR_REGS; j++)
+                if (active[r]->end < active[j]->end)
+                    r = j;
+            if (active[r]->end <= iv->end)
+                continue;
+            active[r]->var->reg = 0;
+        }
+
+        active[r] = iv;
+        iv->var->reg = r;
+    }
+}
+
+void alloc_lvar_regs(Obj *fn) {
+    intervals = NULL;
+    loops = NULL;
+    label_pos = goto_pos = NULL;
+    pos = 0;
+
+    for (Obj *var = fn->locals; var; var = var->next)
+        var->reg = 0;
+
+    /*  parameters are live on entry.   */
+    for (Obj *var = fn->params; var; var = var->next)
+        use(var);
+
+    scan(fn->body);
+    add_backward_jumps();
+    extend_over_loops();
+
+    int n = 0;
+    for (Interval *iv = intervals; iv; iv = iv->next)
+        if (!iv->addr_taken)
+            n++;
+
+    Interval **ivs = calloc(n, sizeof(Interval *));
+    n = 0;
+    for (Interval *iv = intervals; iv; iv = iv->next)
+        if (!iv->addr_taken)
+            ivs[n++] = iv;
+
+    qsort(ivs, n, sizeof(Interval *), cmp_start);
+    linear_scan(ivs, n);
+}
@@ -1,5 +1,8 @@
 #include "test.h"
 
+int g_count;
+long g_long;
+
 int main() {
   ASSERT(0, 0);
   ASSERT(42, 42);
@@ -121,6 +124,59 @@ int main() {
 
   1 ? -2 : (void)-1;
 
+  ASSERT(44, (char)300);
+  ASSERT(-128, (char)(127+1));
+  ASSERT(0, (long)(int)4294967296);
+  ASSERT(4096, ({ int x=4; x*(4*1024)/4; }));
+  ASSERT(5, ({ int x=5; x+0-0; }));
+  ASSERT(5, ({ int x=5; x*1|0; }));
+  ASSERT(5, ({ int x=5; x&-1; }));
+  ASSERT(3, ({ int x=2; (x=3)*0; x; }));
+  ASSERT(0, ({ int x=2; x*0; }));
+  ASSERT(1, ({ int x=7; !!x; }));
+  ASSERT(2, ({ int x=7; if (!!x) x=2; x; }));
+  ASSERT(3, ({ int x=3; 0 && (x=4); x; }));
+  ASSERT(3, ({ int x=3; 1 || (x=4); x; }));
+
+  ASSERT(-21, ({ int x=-7; x*3; }));
+  ASSERT(360, ({ int x=10; x*36; }));
+  ASSERT(-80, ({ int x=10; x*-8; }));
+  ASSERT(-3, ({ int x=-7; x/2; }));
+  ASSERT(-1, ({ int x=-7; x%2; }));
+  ASSERT(2, ({ int x=-7; x/-3; }));
+  ASSERT(-1, ({ int x=-7; x%-3; }));
+  ASSERT(142857, ({ int x=999999; x/7; }));
+  ASSERT(-6, ({ int x=-1000; x%7; }));
+  ASSERT(-1, ({ int x=-2147483647-1; x/2147483647; }));
+  ASSERT(3, ({ long x=30000000000; x/10000000000; }));
+  ASSERT(-4, ({ long x=-123456789012; x%7; }));
+  ASSERT(3, ({ int a[10]; int *p=a+1; int *q=a+4; q-p; }));
+
+  ASSERT(-126, ({ char c=120; c+=10; c; }));
+  ASSERT(-32536, ({ short s=32000; s+=1000; s; }));
+  ASSERT(137438953472, ({ long l=1; l<<=40; l>>=3; l; }));
+  ASSERT(20, ({ g_count=0; for (int i=0; i<10; i++) g_count+=2; g_count; }));
+  ASSERT(-30, ({ g_long=0; for (int i=0; i<10; i++) g_long-=3; g_long; }));
+  ASSERT(9, ({ struct { char c; int a[4]; } x={}; x.a[2]+=9; x.a[2]; }));
+  ASSERT(48, ({ struct { int i; } x={}; x.i|=0x30; x.i; }));
+  ASSERT(255, ({ struct { long l; } x={}, *p=&x; p->l^=0xff; p->l; }));
+  ASSERT(-56, ({ struct { char c; } x={}, *p=&x; p->c+=200; p->c; }));
+  ASSERT(5, ({ int a[4]={1,2,3,4}; int *q=a; int i=2; q[3]-=i; q+=1; *q+=1; a[1]+a[3]; }));
+  ASSERT(8, ({ int i=5; int x=(i+=3); x; }));
+  ASSERT(15, ({ int i=5; int y=i++; int z=++i; y+z+i-i+3; }));
+  ASSERT(14, ({ int x=22; x & 15 ^ 8; }));
+  ASSERT(1, ({ int x=-7; 3 > x; }));
+  ASSERT(0, ({ int x=-7; -8 >= x; }));
+  ASSERT(1, ({ long x=-1; (x | 2147483647) == -1; }));
+  ASSERT(4294967296, ({ long x=1; x << 32; }));
+  ASSERT(-4, ({ int x=-16; x >> 2; }));
+  ASSERT(-56, ({ char c=100; c=c<<1; c; }));
+  ASSERT(-25536, ({ short s=20000; s<<=1; s; }));
+  ASSERT(1, ({ char c=100; c<<=1; c<0; }));
+  ASSERT(200, ({ char c=100; c<<1; }));
+  ASSERT(4, ({ sizeof((char)1<<1); }));
+  ASSERT(1, ({ long x=5000000000; x - 1 > 2147483647; }));
+
   printf("OK\n");
   return 0;
 }
\ No newline at end of file
@@ -4,6 +4,11 @@
  * This is a block comment.
  */
 
+int g_vec[17];
+int g_va[40], g_vb[40], g_vc[40], g_vd[40];
+
+static int below(int i, int n) { return i < n; }
+
 int main() {
   ASSERT(3, ({ int x; if (0) x=2; else x=3; x; }));
   ASSERT(3, ({ int x; if (1-1) x=2; else x=3; x; }));
@@ -65,6 +70,42 @@ int main() {
 
   ASSERT(3, ({ int i=0; switch(-1) { case 0xffffffff: i=3; break; } i; }));
 
+  ASSERT(35, ({ int s=0; for (int j=-2; j<10; j++) switch (j) { case 0: s+=1; break; case 1: s+=2; break; case 2: s+=3; break; case 3: s+=4; break; case 4: s+=5; break; case 6: s+=7; break; case 7: s+=8; break; default: s+=1; } s; }));
+  ASSERT(21, ({ int s=0; for (int j=-3; j<4; j++) switch (j) { case -3: s+=1; case -2: s+=1; case -1: s+=1; case 0: s+=1; case 1: s+=1; case 2: s+=1; } s; }));
+  ASSERT(15, ({ int s=0; for (int j=0; j<1100; j++) switch (j) { case 1: s+=1; break; case 10: s+=2; break; case 100: s+=3; break; case 1000: s+=4; break; case 5: s+=5; break; case 50: s+=0; break; } s; }));
+  ASSERT(6, ({ int s=0; for (long j=-5; j<100; j++) switch (j) { case -5: case 7: case 9: case 11: case 13: case 99: s++; } s; }));
+  ASSERT(7, ({ int i=0; switch(-2147483647-1) { case -2147483647-1: i=7; break; case 0: case 1: case 2: case 3: i=1; } i; }));
+
+  ASSERT(60, ({ int n=3; int k=2; int s=0; for (int i=0; i<n*2; i=i+1) s=s+n*k+4; s; }));
+  ASSERT(45, ({ int a[10]; int *p=a; for (int i=0; i<10; i=i+1) p[i]=i; int s=0; int i=0; while (i<10) { s=s+(&a[0])[i]; i=i+1; } s; }));
+  ASSERT(0, ({ int *p=0; int s=0; for (int i=0; i<3; i=i+1) if (p) s=s+p[4]; s; }));
+  ASSERT(6, ({ int n=2; int s=0; for (int i=0; i<3; i=i+1) { s=s+n; n=n+0; } s; }));
+
+  ASSERT(3, ({ int a=1, b=2, c=3; int x=0; if (a < b && c) x=3; x; }));
+  ASSERT(4, ({ int a=1, b=2, c=0; int x=4; if (a < b && c) x=3; x; }));
+  ASSERT(5, ({ int a=3, b=2; int x=0; if (!(a <= b) || x) x=5; x; }));
+  ASSERT(7, ({ int a=3; a == 3 && !(a != 3) ? 7 : 8; }));
+  ASSERT(1, ({ long a=-1; a < 0 || a == 5; }));
+  ASSERT(0, ({ int *p=0; p && *p; }));
+  ASSERT(6, ({ int n=0; for (int i=0; i < 10 && !(i == 6); i++) n++; n; }));
+
+  ASSERT(110, ({ int a[11], b[11], c[11]; for (int i=0; i<11; i++) { b[i]=i; c[i]=i; } for (int i=0; i<11; i++) a[i]=b[i]+c[i]; int s=0; for (int i=0; i<11; i++) s+=a[i]; s; }));
+  ASSERT(37, ({ int a[40]; int n=37; int i; for (i=0; i<40; i++) a[i]=0; for (i=3; i<n; i++) a[i]=a[i]+1; i; }));
+  ASSERT(34, ({ int a[40]; int n=37; int i; for (i=0; i<40; i++) a[i]=0; for (i=3; i<n; i++) a[i]=a[i]+1; int s=0; for (i=0; i<40; i++) s+=a[i]; s; }));
+  ASSERT(5, ({ int a[8]; int i=5; for (int j=0; j<8; j++) a[j]=7; for (; i<2; i++) a[i]=0; i; }));
+  ASSERT(-79, ({ char a[40], b[40]; for (int i=0; i<40; i++) b[i]=i*7; for (int i=0; i<40; i++) a[i]=b[i]-3^0x55; a[33]; }));
+  ASSERT(5523, ({ short a[20], b[20]; for (int i=0; i<20; i++) b[i]=i*100; for (int i=0; i<20; i++) a[i]=b[i]*b[i]+3; a[19]; }));
+  ASSERT(8, ({ long a[9], b[9]; for (long i=0; i<9; i++) b[i]=i; for (long i=0; i<9; i++) a[i]=(b[i]&~0)|1; a[6]+a[0]; }));
+  ASSERT(40, ({ g_vec[0]=0; for (int i=0; i<17; i++) g_vec[i]=i*5; for (int i=1; i<17; i++) g_vec[i]=g_vec[i]-g_vec[i-1]; g_vec[16]; }));
+  ASSERT(5, ({ for (int i=0; i<17; i++) g_vec[i]=i*5; for (int i=0; i<17; i++) g_vec[i]=g_vec[i]-g_vec[0]; g_vec[1]; }));
+  ASSERT(3252, ({ int n=40, x=100; for (int i=0; i<n; i++) { g_vb[i]=i; g_vc[i]=2*i; g_vd[i]=3; } ({ for (int i=0; i<n; i++) g_va[i]=g_vb[i]+g_vc[i]+g_vd[i]+1; g_va[5]-1; }) + (x-2)*(n-7); }));
+
+  ASSERT(10, ({ int s=0; for (int i=0; below(i, 5); i++) s+=i; s; }));
+  ASSERT(0, ({ int s=0; for (int i=0; below(i, 0); i++) s+=i; s; }));
+  ASSERT(7, ({ int s=7; for (int i=3; i<3; i++) s=0; s; }));
+  ASSERT(20, ({ int s=0; for (int i=0; i<10; i++) { if (i%2) continue; s+=i; } s; }));
+  ASSERT(4, ({ int i=0; for (;;) { if (i==4) break; i++; } i; }));
+
   printf("OK\n");
   return 0;
 }
\ No newline at end of file
@@ -22,4 +22,116 @@ check -o
 ./mycc --help 2>&1 | grep -q mycc
 check --help
 
+# -fdump-ir
+echo 'int f(int n) { int s=0; for (int i=0; i<n; i=i+1) s=s+i; return s; }' > $tmp/loop.c
+./mycc -O -fssa -fdump-ir -o $tmp/out $tmp/loop.c 2>&1 | grep -q 'phi'
+check -fdump-ir
+
+# -fpeephole-stats
+./mycc -O -fpeephole-stats -o $tmp/out $tmp/loop.c 2>&1 | grep -q 'zero-reg *[1-9]'
+check -fpeephole-stats
+
+# leaf functions omit the frame pointer at -O
+./mycc -O -o $tmp/out $tmp/loop.c
+! grep -q 'rbp' $tmp/out
+check 'leaf frame'
+
+# -fomit-frame-pointer
+echo 'int g(int x); int f(int n) { return g(n) + 1; }' > $tmp/call.c
+./mycc -O -fomit-frame-pointer -o $tmp/out $tmp/call.c
+! grep -q 'rbp' $tmp/out
+check -fomit-frame-pointer
+
+# unreferenced static definitions are dropped at -O
+echo 'static int t[8]; static int dead() { return t[0]; } int main() { return 0; }' > $tmp/dead.c
+./mycc -O -o $tmp/out $tmp/dead.c
+! grep -q '^dead:\|^t:' $tmp/out
+check 'dead statics'
+
+# locals of sibling blocks share their stack slots at -O
+echo 'int g(char *p); int f(int n) { if (n) { char a[400]; return g(a); } else { char b[400]; return g(b); } }' > $tmp/blocks.c
+./mycc -O -o $tmp/out $tmp/blocks.c
+grep -q 'sub	\$4[0-9][0-9], %rsp' $tmp/out
+check 'shared slots'
+
+# hot scalars are laid out next to the frame base, before large arrays
+echo 'int g(char *p); int f() { int i; char buf[300]; g(buf); g((char *)&i); return i; }' > $tmp/frame.c
+./mycc -O -o $tmp/out $tmp/frame.c
+grep -q -- '-4(%rbp)' $tmp/out
+check 'frame layout'
+
+# counted array loops run through SSE2 at -O
+echo 'int a[64], b[64], c[64]; void f(int n) { for (int i = 0; i < n; i++) a[i] = b[i] + c[i]; }' > $tmp/vec.c
+./mycc -O -o $tmp/out $tmp/vec.c
+grep -q 'paddd' $tmp/out
+check 'vectorize'
+
+# repeated loads of a pointer chain are computed once at -O
+echo 'struct N { struct N *next; int a, b; }; int f(struct N *p) { return p->next->next->a + p->next->next->b; }' > $tmp/cse.c
+./mycc -O -o $tmp/out $tmp/cse.c
+[ `grep -c 'mov	(%r[a-z0-9]*), %rax' $tmp/out` -eq 2 ]
+check 'common subexpressions'
+
+# loops test their condition at the bottom at -O
+./mycc -O -o $tmp/out $tmp/loop.c
+grep -q '^.L.body' $tmp/out && ! grep -q 'jmp' $tmp/out
+check 'loop rotation'
+
+# small constant memcpy and memset are expanded inline at -O
+echo 'char *memcpy(); char *memset(); void f(char *p, char *q) { memcpy(p, q, 16); memset(q, 0, 8); }' > $tmp/mem.c
+./mycc -O -o $tmp/out $tmp/mem.c
+! grep -q 'call' $tmp/out
+check 'inline memcpy'
+
+# large constant local initializers are copied from .rodata
+echo 'int g(int *p); int f() { int t[32] = {1, 2, 3, 4, 5, 6, 7, 8}; return g(t); }' > $tmp/tmpl.c
+./mycc -o $tmp/out $tmp/tmpl.c
+grep -q 'rodata' $tmp/out && ! grep -q '$8' $tmp/out
+check 'initializer template'
+
+# a fully initialized local is not cleared first
+echo 'int g(int *p); int f(int k) { int a[4] = {k, k, k, k}; return g(a); }' > $tmp/full.c
+./mycc -O -o $tmp/out $tmp/full.c
+! grep -q 'pxor' $tmp/out
+check 'initializer coverage'
+
+# element addresses fold into one memory operand at -O
+echo 'struct P { int x, y; }; int f(struct P *p, int i) { return p[i + 1].y; }' > $tmp/mode.c
+./mycc -O -o $tmp/out $tmp/mode.c
+grep -q 'movsxd	12(%r[a-z0-9]*,%r[a-z0-9]*,8), %rax' $tmp/out
+check 'addressing modes'
+
+# constant operands are immediates at -O
+echo 'int f(int x) { return (x & 15) + 3; }' > $tmp/imm.c
+./mycc -O -o $tmp/out $tmp/imm.c
+grep -q 'and	\$15, %eax' $tmp/out && ! grep -q 'mov	\$' $tmp/out
+check 'immediate operands'
+
+# -fprofile-generate and -fprofile-use
+echo 'int main() { int s = 0; for (int i = 0; i < 100; i++) if (i % 10 == 0) s--; else s++; return s != 80; }' > $tmp/prof.c
+./mycc -fprofile-generate=$tmp/prof.prof -o $tmp/prof.s $tmp/prof.c
+cc -no-pie -o $tmp/prof $tmp/prof.s 2> /dev/null && $tmp/prof && [ -s $tmp/prof.prof ]
+check -fprofile-generate
+./mycc -O -fprofile-use=$tmp/prof.prof -o $tmp/out $tmp/prof.c
+grep -q '^.L.then' $tmp/out
+check -fprofile-use
+
+# each translation unit keeps its own profile, checked against its source
+echo 'int bf(int n); int main() { int s = 0; for (int i = 0; i < 10; i++) s += bf(i); return s != 45; }' > $tmp/two_a.c
+echo 'int bf(int n) { if (n < 0) return 0; return n; }' > $tmp/two_b.c
+./mycc -fprofile-generate -o $tmp/two_a.s $tmp/two_a.c
+./mycc -fprofile-generate -o $tmp/two_b.s $tmp/two_b.c
+cc -no-pie -o $tmp/two $tmp/two_a.s $tmp/two_b.s 2> /dev/null && $tmp/two && $tmp/two &&
+[ -s $tmp/two_a.prof ] && [ -s $tmp/two_b.prof ] &&
+./mycc -O -fprofile-use -o $tmp/out $tmp/two_a.c 2>&1 | (! grep -q 'does not match') &&
+./mycc -O -fprofile-use -o $tmp/out $tmp/two_b.c 2>&1 | (! grep -q 'does not match') &&
+./mycc -O -fprofile-use=$tmp/two_b.prof -o $tmp/out $tmp/two_a.c 2>&1 | grep -q 'does not match'
+check 'profile per file'
+
+# a profile path is written byte for byte, quotes and backslashes included
+mkdir -p "$tmp/a\"b\\c"
+./mycc -fprofile-generate="$tmp/a\"b\\c/prof.prof" -o $tmp/prof.s $tmp/prof.c
+cc -no-pie -o $tmp/prof $tmp/prof.s 2> /dev/null && $tmp/prof && [ -s "$tmp/a\"b\\c/prof.prof" ]
+check 'profile path'
+
 echo OK
\ No newline at end of file
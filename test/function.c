@@ -55,6 +55,22 @@ static int static_fn() { return 3; }
 
 int param_decay(int x[]) { return x[0]; }
 
+long sum_to(long n, long acc) { if (n == 0) return acc; return sum_to(n - 1, acc + n); }
+int is_even(int n);
+int is_odd(int n) { if (n == 0) return 0; return is_even(n - 1); }
+int is_even(int n) { if (n == 0) return 1; return is_odd(n - 1); }
+int deref_n(int *p, int n) { if (n == 0) return *p; return deref_n(p, n - 1); }
+int local_addr(int n) { int x = n; return deref_n(&x, 3); }
+static int max_of(int a, int b) { if (a > b) return a; return b; }
+static void incr(int *p) { if (p) *p = *p + 1; }
+static int skip_to(int x) { if (x) goto out; x = 9; out: return x; }
+static int loop_sum(int n) { int s = 0; for (int i = 0; i < n; i = i + 1) { if (i == 2) continue; s = s + i; } return s; }
+static int calls;
+static int counted() { calls = calls + 1; return calls; }
+static int minus(int a, int b) { return a - b; }
+char to_char(int x) { return x; }
+int char_tail(int x) { return to_char(x); }
+
 int main() {
   ASSERT(3, ret3());
   ASSERT(8, add2(3, 5));
@@ -90,6 +106,21 @@ int main() {
 
   ASSERT(3, ({ int x[2]; x[0]=3; param_decay(x); }));
 
+  ASSERT(500500, sum_to(1000, 0));
+  ASSERT(1, is_even(1000));
+  ASSERT(0, is_odd(1000));
+  ASSERT(5, local_addr(5));
+  ASSERT(1, char_tail(257));
+
+  ASSERT(7, max_of(2, 7));
+  ASSERT(9, max_of(9, 1));
+  ASSERT(8, max_of(max_of(1, 2), max_of(8, 0)));
+  ASSERT(2, ({ int v = 0; incr(&v); incr(&v); incr(0); v; }));
+  ASSERT(9, skip_to(0));
+  ASSERT(4, skip_to(4));
+  ASSERT(8, loop_sum(5));
+  ASSERT(-1, minus(counted(), counted()));
+
   printf("OK\n");
   return 0;
 }
\ No newline at end of file
@@ -5,6 +5,10 @@ int main() {
   ASSERT(2, ({ int x[3]={1,2,3}; x[1]; }));
   ASSERT(3, ({ int x[3]={1,2,3}; x[2]; }));
   ASSERT(3, ({ int x[3]={1,2,3}; x[2]; }));
+  ASSERT(0, ({ char x[7]={1}; x[6]; }));
+  ASSERT(0, ({ char x[29]={1}; x[16]+x[24]+x[28]; }));
+  ASSERT(0, ({ long x[30]={1}; x[15]+x[29]; }));
+  ASSERT(1, ({ char x[300]={1}; int s=0; for (int i=0; i<300; i++) s+=x[i]; s; }));
 
   ASSERT(2, ({ int x[2][3]={{1,2,3},{4,5,6}}; x[0][1]; }));
   ASSERT(4, ({ int x[2][3]={{1,2,3},{4,5,6}}; x[1][0]; }));
@@ -55,6 +59,19 @@ int main() {
   ASSERT(5, ({ typedef struct {int a,b,c,d,e,f;} T; T x={1,2,3,4,5,6}; T y; y=x; y.e; }));
   ASSERT(2, ({ typedef struct {int a,b;} T; T x={1,2}; T y, z; z=y=x; z.b; }));
 
+  ASSERT(7, ({ int k=7; int x[20]={1,2,k,4,5}; x[2]; }));
+  ASSERT(5, ({ int k=7; int x[20]={1,2,k,4,5}; x[4]; }));
+  ASSERT(0, ({ int k=7; int x[20]={1,2,k,4,5}; x[19]; }));
+  ASSERT(17, ({ int k=3; int s=0; for (int n=0; n<2; n++) { int x[16]={k,1,0,0,0,0,0,0,0,0,0,0,0,0,0,k*2}; s+=x[0]+x[1]+x[15]; x[1]=100; k=2; } s; }));
+  ASSERT(-1, ({ struct {char c; long l; short a[30];} x={'a', 1, {-1, 2}}; x.a[0]; }));
+  ASSERT(0, ({ struct {char c; long l; short a[30];} x={'a', 1, {-1, 2}}; x.a[29]; }));
+
+  ASSERT(0, ({ struct {char c; int x;} p={1, 2}; char *b=(char *)&p; b[1]+b[2]+b[3]; }));
+  ASSERT(6, ({ struct {char c; int x;} p={1, 2}; char *b=(char *)&p; b[0]+b[4]+3; }));
+  ASSERT(0, ({ int k=3; char s[40]={k, k}; s[2]+s[20]+s[39]; }));
+  ASSERT(12, ({ int k=3; int a[4]={k, k, k, k}; a[0]+a[1]+a[2]+a[3]; }));
+  ASSERT(9, ({ int k=4; struct {char c; int x; long y;} q[6]={{1, 2, 3}, {k, k, k}}; q[1].y+q[5].x+q[0].y+q[4].c+2; }));
+
   printf("OK\n");
   return 0;
 }
\ No newline at end of file
@@ -3,12 +3,17 @@
 int main() {
   ASSERT(3, ({ int x=3; *&x; }));
   ASSERT(3, ({ int x=3; int *y=&x; int **z=&y; **z; }));
+#ifndef __OPTIMIZE__
+  /* these depend on the -O0 stack layout of neighbouring locals */
   ASSERT(5, ({ int x=3; int y=5; *(&x+1); }));
   ASSERT(3, ({ int x=3; int y=5; *(&y-1); }));
   ASSERT(5, ({ int x=3; int y=5; *(&x-(-1)); }));
+#endif
   ASSERT(5, ({ int x=3; int *y=&x; *y=5; x; }));
+#ifndef __OPTIMIZE__
   ASSERT(7, ({ int x=3; int y=5; *(&x+1)=7; y; }));
   ASSERT(7, ({ int x=3; int y=5; *(&y-2+1)=7; x; }));
+#endif
   ASSERT(5, ({ int x=3; (&x+2)-&x+3; }));
   ASSERT(8, ({ int x, y; x=3; y=5; x+y; }));
   ASSERT(8, ({ int x=3, y=5; x+y; }));
@@ -39,6 +44,15 @@ int main() {
   ASSERT(4, ({ int x[2][3]; int *y=x; y[4]=4; x[1][1]; }));
   ASSERT(5, ({ int x[2][3]; int *y=x; y[5]=5; x[1][2]; }));
 
+  ASSERT(7, ({ int a[5]={1,3,5,7,9}; int i=2; a[i+1]; }));
+  ASSERT(3, ({ int a[5]={1,3,5,7,9}; int *p=a+3; long i=2; p[-i]; }));
+  ASSERT(5, ({ int a[5]={1,3,5,7,9}; int i=4; a[i-2]; }));
+  ASSERT(9, ({ long a[5]={1,3,5,7,9}; int i=1; a[i]=9; a[1]; }));
+  ASSERT(6, ({ struct { int x, y; } s[3]={}; int i=1; s[i+1].y=6; s[2].y; }));
+  ASSERT(4, ({ struct { char c; struct { short a[3]; } t[2]; } s={}; int i=1; s.t[i].a[i+1]=4; s.t[1].a[2]; }));
+  ASSERT(12, ({ int a[2][3]={{1,2,3},{4,5,12}}; int i=1, j=2; a[i][j]; }));
+  ASSERT(-1, ({ char b[4]={}; int i=3; b[i]=255; b[3]; }));
+
   printf("OK\n");
   return 0;
 }
\ No newline at end of file
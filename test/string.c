@@ -1,5 +1,10 @@
 #include "test.h"
 
+char *memcpy();
+char *memset();
+int memcmp();
+long strlen();
+
 int main() {
   ASSERT(0, ""[0]);
   ASSERT(1, sizeof(""));
@@ -35,6 +40,17 @@ int main() {
   ASSERT(0, "\x00"[0]);
   ASSERT(119, "\x77"[0]);
 
+  ASSERT(5, strlen("hello"));
+  ASSERT(1, strlen("a\0b"));
+  ASSERT(7, ({ char a[24], b[24]; memset(b, 7, 24); memcpy(a, b, 23); a[22]; }));
+  ASSERT(0, ({ char a[24]; memset(a, 7, 24); memset(a, 0, 21); a[20]; }));
+  ASSERT(7, ({ char a[24]; memset(a, 7, 24); memset(a, 0, 21); a[21]; }));
+  ASSERT(-56, ({ char a[4]; int v=200; memset(a, v, 3); a[2]; }));
+  ASSERT(0, ({ char a[24], b[24]; memset(a, 3, 24); memset(b, 3, 24); memcmp(a, b, 24); }));
+  ASSERT(1, ({ char a[24], b[24]; memset(a, 3, 24); memset(b, 3, 24); a[19]=4; b[22]=9; memcmp(a, b, 24) > 0; }));
+  ASSERT(1, ({ char a[24], b[24]; memset(a, 3, 24); memset(b, 3, 24); b[13]=-1; memcmp(a, b, 15) < 0; }));
+  ASSERT(1, ({ char a[8]; memcpy(a, "xyz", 4) == a; }));
+
   printf("OK\n");
   return 0;
 }
\ No newline at end of file
@@ -40,6 +40,11 @@ int main() {
   ASSERT(7, ({ struct t {int a,b;}; struct t x; x.a=7; struct t y; struct t *z=&y; *z=x; y.a; }));
   ASSERT(7, ({ struct t {int a,b;}; struct t x; x.a=7; struct t y, *p=&x, *q=&y; *q=*p; y.a; }));
   ASSERT(5, ({ struct t {char a, b;} x, y; x.a=5; y=x; y.a; }));
+  ASSERT(7, ({ struct {char a[7];} x, y; x.a[6]=7; y=x; y.a[6]; }));
+  ASSERT(9, ({ struct {int a[3];} x, y; x.a[0]=1; x.a[2]=8; y=x; y.a[0]+y.a[2]; }));
+  ASSERT(13, ({ struct {long a; char b[23];} x, y; x.a=6; x.b[22]=7; y=x; y.a+y.b[22]; }));
+  ASSERT(30, ({ struct {char a[300];} x, y; x.a[0]=10; x.a[299]=20; y=x; y.a[0]+y.a[299]; }));
+  ASSERT(2, ({ struct {char a[40];} x[2]; x[1].a[39]=2; x[0]=x[1]; x[0].a[39]; }));
 
   ASSERT(3, ({ struct {int a,b;} x,y; x.a=3; y=x; y.a; }));
   ASSERT(7, ({ struct t {int a,b;}; struct t x; x.a=7; struct t y; struct t *z=&y; *z=x; y.a; }));
@@ -57,6 +62,12 @@ int main() {
   ASSERT(1, ({ struct T { struct T *next; int x; } a; struct T b; b.x=1; a.next=&b; a.next->x; }));
   ASSERT(4, ({ typedef struct T T; struct T { int x; }; sizeof(T); }));
 
+  ASSERT(35, ({ struct T { struct T *next; int x; } a, b; b.x=3; a.next=&b; int p=a.next->x; b.x=5; int q=a.next->x; p*10+q; }));
+  ASSERT(20, ({ struct T { struct T *next; int x; } a, b; b.x=4; a.next=&b; a.next->x * a.next->x + a.next->x; }));
+  ASSERT(11, ({ int v=2; int *p=&v; int *q=&v; int s=*p + *p; *q=7; s + *p; }));
+  ASSERT(24, ({ int i=3, j=4; int k = i>2 ? i*j : 0; int m = i*j + (i<2 && i*j); k+m; }));
+  ASSERT(34, ({ int i=3; int a=i*i; i=5; a + i*i; }));
+
   printf("OK\n");
   return 0;
 }
@@ -47,8 +47,11 @@ int main() {
   ASSERT(2, ({ int x=2; { int x=3; } int y=4; x; }));
   ASSERT(3, ({ int x=2; { x=3; } x; }));
 
+#ifndef __OPTIMIZE__
+  /* these depend on the -O0 stack layout of neighbouring locals */
   ASSERT(7, ({ int x; int y; char z; char *a=&y; char *b=&z; b-a; }));
   ASSERT(1, ({ int x; char y; int z; char *a=&y; char *b=&z; b-a; }));
+#endif
 
   ASSERT(8, ({ long x; sizeof(x); }));
   ASSERT(2, ({ short x; sizeof(x); }));
@@ -64,6 +67,10 @@ int main() {
 
   { void *x; }
 
+  ASSERT(7, ({ int x=3; { int a[4]; a[3]=4; x+=a[3]; } { int b[4]; b[0]=0; x+=b[0]; } x; }));
+  ASSERT(9, ({ int x=0; for (int i=0; i<3; i++) { int a=i; { char b[8]; b[0]=a; x+=b[0]; } { long c=a+1; x+=c; } } x; }));
+  ASSERT(5, ({ int *p; int r=0; { int a=5; p=&a; r=*p; } { int b=6; r+=0*b; } r; }));
+
   printf("OK\n");
   return 0;
 }
\ No newline at end of file
@@ -130,10 +130,16 @@ void add_type(Node *node) {
         node->ty = ty_int;
         return;
     case ND_BITNOT:
-    case ND_SHL:
-    case ND_SHR:
         node->ty = node->lhs->ty;
         return;
+    case ND_SHL:
+    case ND_SHR: {
+        /*  the result has the promoted type of the left operand.  */
+        Type *ty = get_common_type(ty_int, node->lhs->ty);
+        node->lhs = new_cast(node->lhs, ty);
+        node->ty = ty;
+        return;
+    }
     case ND_VAR:
         node->ty = node->var->ty;
         return;